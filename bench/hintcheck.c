@@ -0,0 +1,188 @@
+#include "alloc.h"
+#include "macros.h"
+#include <errno.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/*
+ * Check for lifetime-hinted allocation (alloc_hint in alloc.h).
+ *
+ *   nomap    a region whose reservation fails falls back to the main heap
+ *   regions  each hint gets its own region; freed blocks are reused there
+ *   realloc  reallocate grows and shrinks a block inside its region
+ *   flags    several lifetimes or unknown bits fail with EINVAL
+ *   full     an exhausted region falls back to the main heap
+ *
+ * Every fallback must leave errno untouched.
+ */
+
+#define REGION_SPAN     ((size_t)1 << 29)   /* Regions' blocks lie closer than this together */
+#define HUGE_REQUEST    ((size_t)200 << 20)
+#define MAX_HUGE        16
+
+static const int hints[] = { ALLOC_HINT_SHORT, ALLOC_HINT_LONG, ALLOC_HINT_PERMANENT };
+#define NUM_HINTS (int)(sizeof(hints) / sizeof(hints[0]))
+
+#define CHECK(cond, ...) do { if (!(cond)) { \
+    fprintf(stderr, "hintcheck: " __VA_ARGS__); fputc('\n', stderr); exit(EXIT_FAILURE); } } while (0)
+
+
+static size_t distance(const void *a, const void *b)
+{
+    return a > b ? (size_t)((char *)a - (char *)b) : (size_t)((char *)b - (char *)a);
+}
+
+static void *checked_hint(size_t size, int hint)
+{
+    errno = 0;
+    void *p = alloc_hint(size, hint);
+    CHECK(p != NULL, "alloc_hint(%zu, %d) failed: %s", size, hint, strerror(errno));
+    CHECK(errno == 0, "alloc_hint(%zu, %d) set errno to %d", size, hint, errno);
+    memset(p, hint, size);
+    return p;
+}
+
+static long vm_bytes(void)
+{
+    long size = -1;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f == NULL) return -1;
+    if (fscanf(f, "%ld", &size) != 1) size = -1;
+    fclose(f);
+    return size < 0 ? -1 : size * sysconf(_SC_PAGESIZE);
+}
+
+
+/* Runs first, in a child, so that no region has been reserved yet */
+static void nomap(void)
+{
+    pid_t pid = fork();
+    CHECK(pid != -1, "fork failed");
+    if (pid == 0)
+    {
+        char *main_block = alloc(64);
+        CHECK(main_block != NULL, "nomap: alloc failed");
+
+        // Room for small mappings only, never for a region
+        long vm = vm_bytes();
+        CHECK(vm > 0, "nomap: cannot read VM size");
+        struct rlimit rl = { vm + (8 << 20), vm + (8 << 20) };
+        CHECK(setrlimit(RLIMIT_AS, &rl) == 0, "nomap: setrlimit failed");
+
+        char *p = checked_hint(64, ALLOC_HINT_SHORT);
+        CHECK(distance(p, main_block) < REGION_SPAN, "nomap: block not in the main heap");
+        freemem(p);
+        _exit(EXIT_SUCCESS);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0, "nomap: child failed");
+    printf("nomap ok\n");
+}
+
+static void regions(void)
+{
+    char *first[NUM_HINTS];
+    char *main_block = alloc(64);
+    CHECK(main_block != NULL, "regions: alloc failed");
+
+    for (int i = 0; i < NUM_HINTS; i++)
+    {
+        first[i] = checked_hint(64, hints[i]);
+        CHECK(distance(first[i], main_block) >= REGION_SPAN, "regions: hint %d in the main heap", hints[i]);
+        for (int j = 0; j < i; j++)
+            CHECK(distance(first[i], first[j]) >= REGION_SPAN, "regions: hints %d and %d share a region",
+                  hints[i], hints[j]);
+    }
+
+    // A freed block is handed out again for the same size and hint
+    for (int i = 0; i < NUM_HINTS; i++)
+    {
+        char *p = checked_hint(200, hints[i]);
+        CHECK(distance(p, first[i]) < REGION_SPAN, "regions: hint %d left its region", hints[i]);
+        freemem(p);
+        char *q = checked_hint(200, hints[i]);
+        CHECK(q == p, "regions: freed block of hint %d not reused", hints[i]);
+        freemem(q);
+        freemem(first[i]);
+    }
+    freemem(main_block);
+    printf("regions ok\n");
+}
+
+static void realloc_in_region(void)
+{
+    for (int i = 0; i < NUM_HINTS; i++)
+    {
+        char *anchor = checked_hint(64, hints[i]);
+        char *p = checked_hint(100, hints[i]);
+
+        char *grown = reallocate(p, 100000);
+        CHECK(grown != NULL, "realloc: grow failed");
+        CHECK(distance(grown, anchor) < REGION_SPAN, "realloc: grown block of hint %d left its region", hints[i]);
+        for (int k = 0; k < 100; k++)
+            CHECK(grown[k] == (char)hints[i], "realloc: grow lost data");
+
+        char *shrunk = reallocate(grown, 50);
+        CHECK(shrunk == grown, "realloc: shrink moved the block");
+        for (int k = 0; k < 50; k++)
+            CHECK(shrunk[k] == (char)hints[i], "realloc: shrink lost data");
+
+        // The tail given back by the shrink is reused within the region
+        char *tail = checked_hint(50000, hints[i]);
+        CHECK(distance(tail, anchor) < REGION_SPAN, "realloc: tail of hint %d not in its region", hints[i]);
+
+        freemem(tail);
+        freemem(shrunk);
+        freemem(anchor);
+    }
+    printf("realloc ok\n");
+}
+
+static void flags(void)
+{
+    const int bad[] = { ALLOC_HINT_SHORT | ALLOC_HINT_LONG, ALLOC_HINT_LONG | ALLOC_HINT_PERMANENT,
+                        ALLOC_HINT_MASK, ALLOC_HINT_MASK + 1, -1 };
+
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+    {
+        errno = 0;
+        CHECK(alloc_hint(64, bad[i]) == NULL && errno == EINVAL, "flags: %#x accepted", bad[i]);
+    }
+    printf("flags ok\n");
+}
+
+static void full(void)
+{
+    char *anchor = checked_hint(64, ALLOC_HINT_PERMANENT);
+    char *huge[MAX_HUGE];
+    int n = 0;
+
+    // Only headers are written, so this costs address space, not memory
+    for (; n < MAX_HUGE; n++)
+    {
+        errno = 0;
+        huge[n] = alloc_hint(HUGE_REQUEST, ALLOC_HINT_PERMANENT);
+        CHECK(huge[n] != NULL, "full: fallback failed: %s", strerror(errno));
+        CHECK(errno == 0, "full: errno set to %d", errno);
+        if (distance(huge[n], anchor) >= REGION_SPAN * 2) break; // served by the main heap
+    }
+    CHECK(n < MAX_HUGE, "full: region never ran out");
+
+    for (int i = 0; i <= n; i++)
+        freemem(huge[i]);
+    freemem(anchor);
+    printf("full ok\n");
+}
+
+
+int main(void)
+{
+    nomap();
+    regions();
+    realloc_in_region();
+    flags();
+    full();
+    return 0;
+}
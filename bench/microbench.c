@@ -0,0 +1,340 @@
+#include "alloc.h"
+#include "macros.h"
+#include "sizeclass.h"
+#include <errno.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * Per-size-class latency microbenchmark.
+ *
+ * Every size class the allocator uses (each quick list, each seglist class
+ * not shadowed by the quick lists, and large blocks) is driven through a
+ * set of alloc/free patterns, first against alloc/freemem/reallocate and
+ * then against glibc malloc/free/realloc. Each call is timed on its own and
+ * the p50/p99/p999 latencies are printed as CSV on stdout:
+ *
+ *   allocator,kind,class,block_size,payload,pattern,op,samples,p50,p99,p999
+ *
+ * Both allocators grow the heap with sbrk. To keep each heap undisturbed by
+ * the other, all of our runs finish before glibc is touched, and nothing in
+ * the timing loop (buffers, sorting, output) may call malloc: buffers come
+ * from mmap and results are printed only once both phases are done.
+ *
+ * Usage: microbench [objects] [rounds]
+ */
+
+#define DEFAULT_OBJECTS   1000
+#define DEFAULT_ROUNDS    16
+#define MAX_LIVE_BYTES    (32 << 20)  /* Cap on live bytes for the large classes */
+#define MAX_CLASSES       64
+#define MAX_RESULTS       2048
+#define RNG_SEED          0x9E3779B97F4A7C15ULL
+
+
+typedef struct allocator {
+    const char *name;
+    void *(*alloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+} allocator;
+
+typedef struct size_class {
+    const char *kind;       // "quick", "seglist" or "large".
+    int index;              // Quick list / seglist index the block lands in.
+    size_t block_size;      // Block size including header and footer.
+    size_t payload;         // Requested size that maps to block_size.
+} size_class;
+
+typedef struct result {
+    const char *allocator;
+    const size_class *sc;
+    const char *pattern;
+    const char *op;
+    size_t samples;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+} result;
+
+enum pattern { LIFO, FIFO, RANDOM, REALLOC, NUM_PATTERNS };
+static const char *pattern_names[NUM_PATTERNS] = { "lifo", "fifo", "random", "realloc" };
+
+static size_class classes[MAX_CLASSES];
+static int num_classes = 0;
+
+static result results[MAX_RESULTS];
+static int num_results = 0;
+
+static void **objects;
+static size_t *order;
+static uint64_t *alloc_samples;
+static uint64_t *free_samples;
+static uint64_t *realloc_samples;
+
+
+static inline uint64_t ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_lfence();
+    uint64_t t = __rdtsc();
+    _mm_lfence();
+    return t;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+
+static uint64_t rng_state = RNG_SEED;
+
+static uint64_t xorshift64(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+
+static void *map_or_die(size_t bytes)
+{
+    void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+
+/* glibc's qsort may malloc a scratch buffer, so sort in place with a heapsort */
+static void sift_down(uint64_t *a, size_t root, size_t n)
+{
+    while (2 * root + 1 < n)
+    {
+        size_t child = 2 * root + 1;
+        if (child + 1 < n && a[child + 1] > a[child]) child++;
+        if (a[root] >= a[child]) return;
+        uint64_t tmp = a[root];
+        a[root] = a[child];
+        a[child] = tmp;
+        root = child;
+    }
+}
+
+static void sort_samples(uint64_t *a, size_t n)
+{
+    if (n < 2) return;
+    for (size_t i = n / 2; i-- > 0;)
+        sift_down(a, i, n);
+    for (size_t end = n - 1; end > 0; end--)
+    {
+        uint64_t tmp = a[0];
+        a[0] = a[end];
+        a[end] = tmp;
+        sift_down(a, 0, end);
+    }
+}
+
+static uint64_t percentile(const uint64_t *sorted, size_t n, double p)
+{
+    size_t i = (size_t)(p * (n - 1) + 0.5);
+    return sorted[i];
+}
+
+static void record(const char *name, const size_class *sc, const char *pattern,
+                   const char *op, uint64_t *samples, size_t n)
+{
+    if (n == 0 || num_results == MAX_RESULTS) return;
+    sort_samples(samples, n);
+
+    result *r = &results[num_results++];
+    r->allocator = name;
+    r->sc = sc;
+    r->pattern = pattern;
+    r->op = op;
+    r->samples = n;
+    r->p50 = percentile(samples, n, 0.50);
+    r->p99 = percentile(samples, n, 0.99);
+    r->p999 = percentile(samples, n, 0.999);
+}
+
+
+/*
+ * Builds the class table from the allocator's generated layout: one entry
+ * per quick list, one per seglist whose largest block is too big for the
+ * quick lists, and two sizes that fall in the last (unbounded) seglist.
+ */
+static void add_class(const char *kind, int index, size_t block_size)
+{
+    size_class *sc = &classes[num_classes++];
+    sc->kind = kind;
+    sc->index = index;
+    sc->block_size = block_size;
+    sc->payload = block_size - 2 * DSIZE; // ALIGN(payload) == block_size
+}
+
+static void build_classes(void)
+{
+    size_t last_bound = seglist_limits[NUM_FREE_LISTS - 2];
+
+    for (int i = 0; i < NUM_QUICK_LISTS; i++)
+        add_class("quick", i, quick_class_sizes[i]);
+
+    for (int i = 0; i < NUM_FREE_LISTS - 1; i++)
+    {
+        if (seglist_limits[i] > QUICK_CLASS_MAX) // Largest block of class i
+            add_class("seglist", i, seglist_limits[i]);
+    }
+
+    add_class("large", NUM_FREE_LISTS - 1, last_bound * 4);
+    add_class("large", NUM_FREE_LISTS - 1, last_bound * 32);
+}
+
+
+static void shuffle(size_t n)
+{
+    for (size_t i = 0; i < n; i++) order[i] = i;
+    for (size_t i = n - 1; i > 0; i--)
+    {
+        size_t j = xorshift64() % (i + 1);
+        size_t tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+}
+
+static void run_pattern(const allocator *a, const size_class *sc, enum pattern pat,
+                        size_t objs, size_t rounds)
+{
+    size_t n = objs;
+    if (n * sc->block_size > MAX_LIVE_BYTES) n = MAX_LIVE_BYTES / sc->block_size;
+    if (n == 0) n = 1;
+
+    size_t na = 0, nf = 0, nr = 0;
+    uint64_t t0, t1;
+
+    rng_state = RNG_SEED;
+    for (size_t r = 0; r < rounds; r++)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            t0 = ticks();
+            objects[i] = a->alloc(sc->payload);
+            t1 = ticks();
+            if (objects[i] == NULL)
+            {
+                fprintf(stderr, "%s: alloc(%zu) failed\n", a->name, sc->payload);
+                exit(EXIT_FAILURE);
+            }
+            *(char *)objects[i] = (char)i;
+            alloc_samples[na++] = t1 - t0;
+        }
+
+        if (pat == REALLOC)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                t0 = ticks();
+                void *p = a->realloc(objects[i], 2 * sc->payload);
+                t1 = ticks();
+                if (p == NULL)
+                {
+                    fprintf(stderr, "%s: realloc(%zu) failed\n", a->name, 2 * sc->payload);
+                    exit(EXIT_FAILURE);
+                }
+                objects[i] = p;
+                realloc_samples[nr++] = t1 - t0;
+            }
+        }
+
+        if (pat == RANDOM) shuffle(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            size_t k;
+            switch (pat)
+            {
+                case FIFO:   k = i; break;
+                case RANDOM: k = order[i]; break;
+                default:     k = n - 1 - i; break; // LIFO, REALLOC
+            }
+            t0 = ticks();
+            a->free(objects[k]);
+            t1 = ticks();
+            free_samples[nf++] = t1 - t0;
+        }
+    }
+
+    const char *pname = pattern_names[pat];
+    record(a->name, sc, pname, "alloc", alloc_samples, na);
+    record(a->name, sc, pname, "realloc", realloc_samples, nr);
+    record(a->name, sc, pname, "free", free_samples, nf);
+}
+
+static void run_allocator(const allocator *a, size_t objs, size_t rounds)
+{
+    for (int c = 0; c < num_classes; c++)
+        for (int p = 0; p < NUM_PATTERNS; p++)
+            run_pattern(a, &classes[c], p, objs, rounds);
+}
+
+
+static size_class timer_class = { "none", 0, 0, 0 };
+
+static void measure_timer(size_t samples)
+{
+    for (size_t i = 0; i < samples; i++)
+    {
+        uint64_t t0 = ticks();
+        uint64_t t1 = ticks();
+        alloc_samples[i] = t1 - t0;
+    }
+    record("timer", &timer_class, "none", "overhead", alloc_samples, samples);
+}
+
+
+int main(int argc, char *argv[])
+{
+    size_t objs = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_OBJECTS;
+    size_t rounds = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_ROUNDS;
+    if (objs == 0 || rounds == 0)
+    {
+        fprintf(stderr, "usage: %s [objects] [rounds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    size_t samples = objs * rounds;
+    objects = map_or_die(objs * sizeof(*objects));
+    order = map_or_die(objs * sizeof(*order));
+    alloc_samples = map_or_die(samples * sizeof(*alloc_samples));
+    free_samples = map_or_die(samples * sizeof(*free_samples));
+    realloc_samples = map_or_die(samples * sizeof(*realloc_samples));
+
+    build_classes();
+    measure_timer(samples);
+
+    allocator ours = { "alloc", alloc, freemem, reallocate };
+    allocator glibc = { "glibc", malloc, free, realloc };
+
+    run_allocator(&ours, objs, rounds);
+    run_allocator(&glibc, objs, rounds);
+
+    printf("allocator,kind,class,block_size,payload,pattern,op,samples,p50,p99,p999\n");
+    for (int i = 0; i < num_results; i++)
+    {
+        result *r = &results[i];
+        printf("%s,%s,%d,%zu,%zu,%s,%s,%zu,%llu,%llu,%llu\n",
+               r->allocator, r->sc->kind, r->sc->index, r->sc->block_size, r->sc->payload,
+               r->pattern, r->op, r->samples, (unsigned long long)r->p50,
+               (unsigned long long)r->p99, (unsigned long long)r->p999);
+    }
+    return 0;
+}
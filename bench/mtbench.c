@@ -0,0 +1,433 @@
+#include "alloc.h"
+#include "macros.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <time.h>
+
+/*
+ * Multithreaded scalability benchmark, in the spirit of larson,
+ * xmalloc-test and cache-scratch/threadtest.
+ *
+ * Each workload runs at 1, 2, 4, ... up to max_threads threads, first on
+ * alloc/freemem/reallocate and then on glibc, and one CSV row is printed
+ * per run:
+ *
+ *   workload,allocator,threads,ops,seconds,mops_per_sec,rss_kb,shared_lines
+ *
+ * Workloads:
+ *   private    every thread churns its own set of live objects, with
+ *              an occasional reallocate (larson)
+ *   prodcons   thread i allocates, thread i+1 frees (xmalloc-test)
+ *   falseshare threads allocate small objects concurrently and then only
+ *              write to their own; shared_lines counts cache lines holding
+ *              objects of more than one thread (cache-scratch)
+ *
+ * Every run happens in its own forked child, so no heap carries over from
+ * an earlier run. rss_kb is how much the resident set size has grown from
+ * just before setup to the point where every thread still holds its live
+ * objects.
+ *
+ * Unless it is built with the per-CPU front end (PERCPU_CACHE), the allocator
+ * keeps all of its state in unguarded globals, so its entry points are
+ * serialized by a single mutex here; those "alloc" rows are the baseline
+ * that concurrency support in the allocator has to beat.
+ *
+ * Usage: mtbench [max_threads] [ops_per_thread]
+ */
+
+#define DEFAULT_OPS        200000
+#define PRIVATE_SLOTS      1024
+#define MIN_OBJ            16
+#define MAX_OBJ            512
+#define RING_SIZE          1024     /* Must be a power of two */
+#define SHARE_OBJS         8        /* Small objects per thread in falseshare */
+#define SHARE_OBJ_SIZE     8
+#define CACHE_LINE         64
+#define MAX_THREADS        256
+
+
+typedef struct allocator {
+    const char *name;
+    void *(*alloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+} allocator;
+
+/* Single-producer single-consumer ring; thread i produces into ring i+1 */
+typedef struct ring {
+    void *slots[RING_SIZE];
+    size_t head __attribute__((aligned(CACHE_LINE)));  // Next slot to consume.
+    size_t tail __attribute__((aligned(CACHE_LINE)));  // Next slot to produce.
+} ring;
+
+typedef struct worker {
+    pthread_t thread;
+    int id;
+    uint64_t rng;
+    double start;           // Timed section, as seen by this thread.
+    double end;
+    void *share_objs[SHARE_OBJS];
+} worker;
+
+typedef struct workload {
+    const char *name;
+    void (*setup)(worker *w);
+    void (*run)(worker *w);
+    void (*cleanup)(worker *w);
+} workload;
+
+
+static const allocator *cur_alloc;
+static const workload *cur_load;
+static int num_threads;
+static size_t ops_per_thread = DEFAULT_OPS;
+static pthread_barrier_t barrier;
+
+static worker workers[MAX_THREADS];
+static void *private_slots[MAX_THREADS][PRIVATE_SLOTS];
+static ring rings[MAX_THREADS];
+
+
+/* Serialize our allocator, which has no locking of its own */
+static pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *locked_alloc(size_t size)
+{
+    pthread_mutex_lock(&alloc_lock);
+    void *p = alloc(size);
+    pthread_mutex_unlock(&alloc_lock);
+    return p;
+}
+
+static void locked_free(void *ptr)
+{
+    pthread_mutex_lock(&alloc_lock);
+    freemem(ptr);
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+static void *locked_realloc(void *ptr, size_t size)
+{
+    pthread_mutex_lock(&alloc_lock);
+    void *p = reallocate(ptr, size);
+    pthread_mutex_unlock(&alloc_lock);
+    return p;
+}
+
+
+static uint64_t xorshift64(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static size_t random_size(worker *w)
+{
+    return MIN_OBJ + xorshift64(&w->rng) % (MAX_OBJ - MIN_OBJ + 1);
+}
+
+static void *checked_alloc(size_t size)
+{
+    void *p = cur_alloc->alloc(size);
+    if (p == NULL)
+    {
+        fprintf(stderr, "%s: alloc(%zu) failed\n", cur_alloc->name, size);
+        exit(EXIT_FAILURE);
+    }
+    *(char *)p = (char)size;
+    return p;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static long rss_kb(void)
+{
+    long size, resident;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f == NULL) return -1;
+    if (fscanf(f, "%ld %ld", &size, &resident) != 2) resident = -1;
+    fclose(f);
+    return resident < 0 ? -1 : resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+
+/* private: larson-style churn on thread-local slots */
+static void private_setup(worker *w)
+{
+    for (int i = 0; i < PRIVATE_SLOTS; i++)
+        private_slots[w->id][i] = checked_alloc(random_size(w));
+}
+
+static void private_run(worker *w)
+{
+    void **slots = private_slots[w->id];
+    for (size_t i = 0; i < ops_per_thread; i++)
+    {
+        size_t k = xorshift64(&w->rng) % PRIVATE_SLOTS;
+
+        // Every eighth op resizes in place of a free/alloc pair.
+        if ((i & 7) == 0)
+        {
+            void *p = cur_alloc->realloc(slots[k], random_size(w));
+            if (p == NULL)
+            {
+                fprintf(stderr, "%s: realloc failed\n", cur_alloc->name);
+                exit(EXIT_FAILURE);
+            }
+            slots[k] = p;
+            continue;
+        }
+        cur_alloc->free(slots[k]);
+        slots[k] = checked_alloc(random_size(w));
+    }
+}
+
+static void private_cleanup(worker *w)
+{
+    for (int i = 0; i < PRIVATE_SLOTS; i++)
+        cur_alloc->free(private_slots[w->id][i]);
+}
+
+
+/* prodcons: objects allocated on one thread are freed on the next */
+static int ring_pop(ring *r, void **out)
+{
+    size_t head = r->head;
+    if (head == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) return 0;
+    *out = r->slots[head & (RING_SIZE - 1)];
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static int ring_push(ring *r, void *p)
+{
+    size_t tail = r->tail;
+    if (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == RING_SIZE) return 0;
+    r->slots[tail & (RING_SIZE - 1)] = p;
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static void prodcons_setup(worker *w)
+{
+    rings[w->id].head = 0;
+    rings[w->id].tail = 0;
+}
+
+static void prodcons_run(worker *w)
+{
+    ring *in = &rings[w->id];
+    ring *out = &rings[(w->id + 1) % num_threads];
+    size_t produced = 0, consumed = 0;
+    void *pending = NULL;
+    void *p;
+
+    // Each thread receives exactly ops_per_thread objects from its predecessor.
+    while (produced < ops_per_thread || consumed < ops_per_thread)
+    {
+        if (produced < ops_per_thread)
+        {
+            if (pending == NULL) pending = checked_alloc(random_size(w));
+            if (ring_push(out, pending))
+            {
+                pending = NULL;
+                produced++;
+            }
+        }
+        if (ring_pop(in, &p))
+        {
+            cur_alloc->free(p);
+            consumed++;
+        }
+    }
+}
+
+static void prodcons_cleanup(worker *w)
+{
+}
+
+
+/* falseshare: small objects from different threads landing on one line */
+static void falseshare_setup(worker *w)
+{
+    for (int i = 0; i < SHARE_OBJS; i++)
+        w->share_objs[i] = checked_alloc(SHARE_OBJ_SIZE);
+}
+
+static void falseshare_run(worker *w)
+{
+    for (size_t i = 0; i < ops_per_thread; i++)
+        for (int j = 0; j < SHARE_OBJS; j++)
+            (*(volatile char *)w->share_objs[j])++;
+}
+
+static void falseshare_cleanup(worker *w)
+{
+    for (int i = 0; i < SHARE_OBJS; i++)
+        cur_alloc->free(w->share_objs[i]);
+}
+
+static int shared_lines(void)
+{
+    int shared = 0;
+    int total = num_threads * SHARE_OBJS;
+
+    for (int i = 0; i < total; i++)
+    {
+        uintptr_t line = (uintptr_t)workers[i / SHARE_OBJS].share_objs[i % SHARE_OBJS] / CACHE_LINE;
+        int owner = i / SHARE_OBJS;
+        int first = 1, other = 0;
+
+        // Count each line once, at its first object, if a second owner uses it.
+        for (int j = 0; j < total; j++)
+        {
+            uintptr_t l = (uintptr_t)workers[j / SHARE_OBJS].share_objs[j % SHARE_OBJS] / CACHE_LINE;
+            if (l != line) continue;
+            if (j < i) first = 0;
+            if (j / SHARE_OBJS != owner) other = 1;
+        }
+        if (first && other) shared++;
+    }
+    return shared;
+}
+
+
+static const workload workloads[] = {
+    { "private",    private_setup,    private_run,    private_cleanup },
+    { "prodcons",   prodcons_setup,   prodcons_run,   prodcons_cleanup },
+    { "falseshare", falseshare_setup, falseshare_run, falseshare_cleanup },
+};
+
+
+/*
+ * Workers set up, then meet the main thread at three barriers: start of
+ * the timed section, end of it (live objects still held for the RSS
+ * reading), and release into cleanup.
+ */
+static void *worker_main(void *arg)
+{
+    worker *w = arg;
+    cur_load->setup(w);
+    pthread_barrier_wait(&barrier);
+    w->start = now();
+    cur_load->run(w);
+    w->end = now();
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+    cur_load->cleanup(w);
+    return NULL;
+}
+
+static void run(const allocator *a, const workload *load, int threads)
+{
+    cur_alloc = a;
+    cur_load = load;
+    num_threads = threads;
+    pthread_barrier_init(&barrier, NULL, threads + 1);
+    long rss_before = rss_kb();
+
+    for (int i = 0; i < threads; i++)
+    {
+        workers[i].id = i;
+        workers[i].rng = 0x9E3779B97F4A7C15ULL * (i + 1);
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0)
+        {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+
+    // Wall time from the first thread starting to the last one finishing.
+    double start = workers[0].start, end = workers[0].end;
+    for (int i = 1; i < threads; i++)
+    {
+        if (workers[i].start < start) start = workers[i].start;
+        if (workers[i].end > end) end = workers[i].end;
+    }
+    double secs = end - start;
+    long rss = rss_kb();
+    if (rss >= 0 && rss_before >= 0) rss -= rss_before;
+    int shared = load->run == falseshare_run ? shared_lines() : 0;
+    pthread_barrier_wait(&barrier);
+
+    for (int i = 0; i < threads; i++)
+        pthread_join(workers[i].thread, NULL);
+    pthread_barrier_destroy(&barrier);
+
+    size_t ops = ops_per_thread * threads;
+    printf("%s,%s,%d,%zu,%.6f,%.3f,%ld,%d\n", load->name, a->name, threads, ops,
+           secs, ops / secs / 1e6, rss, shared);
+    fflush(stdout);
+}
+
+
+/* Runs one configuration in a child process so it starts from a fresh heap */
+static void run_isolated(const allocator *a, const workload *load, int threads)
+{
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0)
+    {
+        run(a, load, threads);
+        _exit(EXIT_SUCCESS);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        fprintf(stderr, "%s/%s/%d: run failed\n", load->name, a->name, threads);
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/* 1, 2, 4, ... and finally max itself if it is not a power of two */
+static int next_thread_count(int t, int max)
+{
+    if (t == max) return max + 1;
+    return t * 2 > max ? max : t * 2;
+}
+
+
+int main(int argc, char *argv[])
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = argc > 1 ? atoi(argv[1]) : (int)MAX(ncpu, 1);
+    if (argc > 2) ops_per_thread = strtoul(argv[2], NULL, 10);
+    if (max_threads < 1 || max_threads > MAX_THREADS || ops_per_thread == 0)
+    {
+        fprintf(stderr, "usage: %s [max_threads (1-%d)] [ops_per_thread]\n", argv[0], MAX_THREADS);
+        return EXIT_FAILURE;
+    }
+
+#ifdef PERCPU_CACHE
+    allocator ours = { "alloc", alloc, freemem, reallocate };
+#else
+    allocator ours = { "alloc", locked_alloc, locked_free, locked_realloc };
+#endif
+    allocator glibc = { "glibc", malloc, free, realloc };
+    const allocator *allocators[] = { &ours, &glibc };
+
+    printf("workload,allocator,threads,ops,seconds,mops_per_sec,rss_kb,shared_lines\n");
+    fflush(stdout); // or every child would print it again
+    for (int a = 0; a < 2; a++)
+        for (size_t l = 0; l < sizeof(workloads) / sizeof(workloads[0]); l++)
+            for (int t = 1; t <= max_threads; t = next_thread_count(t, max_threads))
+                run_isolated(allocators[a], &workloads[l], t);
+    return 0;
+}
@@ -0,0 +1,245 @@
+#include "alloc.h"
+#include "macros.h"
+#include "pheap.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/wait.h>
+
+/*
+ * Reopen check for the persistent heap (see pheap.h).
+ *
+ * Builds a rooted linked list in a file heap and reopens it through every
+ * path pheap_open has:
+ *
+ *   clean    after pheap_close; the saved free lists are used as they are
+ *   crash    after a child exits without pheap_close; the lists are rebuilt
+ *   layout   after the saved size-class layout is altered; also rebuilt
+ *   corrupt  after the magic is overwritten; the open must fail
+ *
+ * After each reopen the list is walked from pheap_root, pheap_check must
+ * pass, and memory freed before the reopen must be handed out again
+ * without growing the heap.
+ *
+ * Usage: pheapcheck [file]
+ */
+
+#define NUM_NODES       2000
+#define HEAP_CAPACITY   (16 << 20)
+#define NODE_STRIDE     24
+
+
+typedef struct node {
+    size_t next;            // pheap_offset of the next node, 0 at the end.
+    uint32_t id;
+    uint32_t len;
+    unsigned char data[];   // len bytes of (unsigned char)id.
+} node;
+
+typedef struct graph {
+    size_t head;            // pheap_offset of the first node.
+    size_t count;
+} graph;
+
+
+static const char *path;
+
+#define CHECK(cond, ...) do { if (!(cond)) { \
+    fprintf(stderr, "pheapcheck: " __VA_ARGS__); fputc('\n', stderr); exit(EXIT_FAILURE); } } while (0)
+
+
+static size_t heap_brk(void)
+{
+    return ((heap_super *)heap_base)->brk;
+}
+
+static node *new_node(uint32_t id)
+{
+    uint32_t len = (id % 13) * NODE_STRIDE;
+    node *n = alloc(sizeof(node) + len);
+    CHECK(n != NULL, "alloc of node %u failed", id);
+    n->id = id;
+    n->len = len;
+    memset(n->data, (unsigned char)id, len);
+    return n;
+}
+
+/* Fresh heap holding NUM_NODES nodes, with garbage freed in between */
+static void build(void)
+{
+    unlink(path);
+    CHECK(pheap_open(path, HEAP_CAPACITY) == 0, "open of new heap failed: %s", strerror(errno));
+
+    graph *g = alloc(sizeof(graph));
+    CHECK(g != NULL, "alloc of root failed");
+    g->head = 0;
+    g->count = 0;
+    CHECK(pheap_set_root(g) == 0, "pheap_set_root failed");
+
+    for (uint32_t id = NUM_NODES; id > 0; id--)
+    {
+        node *n = new_node(id);
+        n->next = g->head;
+        g->head = pheap_offset(n);
+        g->count++;
+        if (id % 5 == 0) freemem(alloc(16 + id % 300));
+    }
+    CHECK(pheap_check() == 0, "new heap is inconsistent");
+    CHECK(pheap_close() == 0, "close failed: %s", strerror(errno));
+}
+
+/* Walks the list from the root, checking every node */
+static void verify(const char *stage)
+{
+    CHECK(pheap_check() == 0, "%s: heap is inconsistent", stage);
+
+    graph *g = pheap_root();
+    CHECK(g != NULL, "%s: no root", stage);
+
+    size_t count = 0;
+    uint32_t last = 0;
+    for (node *n = pheap_ptr(g->head); n != NULL; n = pheap_ptr(n->next))
+    {
+        CHECK(n->id > last && n->id <= NUM_NODES, "%s: node %u out of order", stage, n->id);
+        CHECK(n->len == (n->id % 13) * NODE_STRIDE, "%s: node %u has a bad length", stage, n->id);
+        for (uint32_t i = 0; i < n->len; i++)
+            CHECK(n->data[i] == (unsigned char)n->id, "%s: node %u is corrupt", stage, n->id);
+        last = n->id;
+        count++;
+    }
+    CHECK(count == g->count, "%s: %zu nodes, root says %zu", stage, count, g->count);
+}
+
+/* Frees every other node, returning the number freed */
+static size_t drop_half(void)
+{
+    graph *g = pheap_root();
+    size_t dropped = 0;
+
+    for (node *n = pheap_ptr(g->head); n != NULL; n = pheap_ptr(n->next))
+    {
+        node *victim = pheap_ptr(n->next);
+        if (victim == NULL) break;
+        n->next = victim->next;
+        freemem(victim);
+        dropped++;
+    }
+    g->count -= dropped;
+    return dropped;
+}
+
+/* Every freed block must be reusable for a small request without growth */
+static void reuse(const char *stage, size_t freed)
+{
+    static void *tmp[NUM_NODES];
+    size_t brk = heap_brk();
+
+    for (size_t i = 0; i < freed; i++)
+    {
+        tmp[i] = alloc(sizeof(node));
+        CHECK(tmp[i] != NULL, "%s: alloc after reopen failed", stage);
+    }
+    CHECK(heap_brk() == brk, "%s: heap grew from %zu to %zu reusing %zu freed blocks",
+          stage, brk, heap_brk(), freed);
+    for (size_t i = 0; i < freed; i++)
+        freemem(tmp[i]);
+}
+
+static uint32_t clean_flag(void)
+{
+    uint32_t clean;
+    int fd = open(path, O_RDONLY);
+    CHECK(fd != -1 && pread(fd, &clean, sizeof(clean), offsetof(heap_super, clean)) == sizeof(clean),
+          "cannot read %s", path);
+    close(fd);
+    return clean;
+}
+
+static void patch(size_t off, const void *val, size_t len)
+{
+    int fd = open(path, O_WRONLY);
+    CHECK(fd != -1 && pwrite(fd, val, len, off) == (ssize_t)len, "cannot patch %s", path);
+    close(fd);
+}
+
+
+static void clean_reopen(void)
+{
+    CHECK(clean_flag() == 1, "clean: heap not marked clean after close");
+    CHECK(pheap_open(path, HEAP_CAPACITY) == 0, "clean: open failed: %s", strerror(errno));
+    verify("clean");
+    reuse("clean", drop_half());
+    verify("clean");
+    CHECK(pheap_close() == 0, "clean: close failed");
+    printf("clean ok\n");
+}
+
+static void crash_reopen(void)
+{
+    size_t freed;
+    int pipefd[2];
+    CHECK(pipe(pipefd) == 0, "pipe failed");
+
+    pid_t pid = fork();
+    CHECK(pid != -1, "fork failed");
+    if (pid == 0)
+    {
+        CHECK(pheap_open(path, HEAP_CAPACITY) == 0, "crash: open failed: %s", strerror(errno));
+        freed = drop_half();
+        CHECK(write(pipefd[1], &freed, sizeof(freed)) == sizeof(freed), "crash: write failed");
+        _exit(EXIT_SUCCESS); // without pheap_close
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0, "crash: child failed");
+    CHECK(read(pipefd[0], &freed, sizeof(freed)) == sizeof(freed), "crash: read failed");
+    close(pipefd[0]);
+    close(pipefd[1]);
+
+    CHECK(clean_flag() == 0, "crash: heap marked clean without close");
+    CHECK(pheap_open(path, HEAP_CAPACITY) == 0, "crash: open failed: %s", strerror(errno));
+    verify("crash");
+    reuse("crash", freed);
+    CHECK(pheap_close() == 0, "crash: close failed");
+    printf("crash ok\n");
+}
+
+static void layout_reopen(void)
+{
+    // A different first seglist bound makes the saved lists unusable
+    size_t bound = 0;
+    patch(offsetof(heap_super, seglist_limits), &bound, sizeof(bound));
+
+    CHECK(pheap_open(path, HEAP_CAPACITY) == 0, "layout: open failed: %s", strerror(errno));
+    verify("layout");
+    reuse("layout", drop_half());
+    verify("layout");
+    CHECK(pheap_close() == 0, "layout: close failed");
+    printf("layout ok\n");
+}
+
+static void corrupt_reopen(void)
+{
+    uint64_t magic = 0;
+    patch(offsetof(heap_super, magic), &magic, sizeof(magic));
+
+    CHECK(pheap_open(path, HEAP_CAPACITY) == -1 && errno == EINVAL, "corrupt: open did not fail");
+    CHECK(pheap_root() == NULL, "corrupt: heap left attached");
+    printf("corrupt ok\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    path = argc > 1 ? argv[1] : "pheapcheck.heap";
+
+    build();
+    clean_reopen();
+    crash_reopen();
+    layout_reopen();
+    corrupt_reopen();
+
+    unlink(path);
+    return 0;
+}
@@ -11,13 +11,21 @@
 #define IN_QUICK_LIST         0x2
 
 typedef size_t header;
+
+/*
+ * Position of a block relative to heap_base; 0 stands for NULL. Free lists
+ * are linked by offset so a file-backed heap still works when it is mapped
+ * at a different address (see pheap.h).
+ */
+typedef size_t heap_offset;
+
 typedef struct block {
     header header;
     union {
         /* A free block contains links to other blocks in a free list. */
         struct {
-            struct block *next;
-            struct block *prev;
+            heap_offset next;
+            heap_offset prev;
         } links;
         /* An allocated block contains a payload (aligned), starting here. */
         char payload[0];   // Length varies according to block size.
@@ -29,13 +37,36 @@ typedef struct block {
 #define QUICK_LIST_MAX   5  /* Maximum number of blocks permitted on a single quick list. */
 #define NUM_FREE_LISTS 12
 
-extern size_t current_payload;
-struct block free_list_heads[NUM_FREE_LISTS];
-
-struct {
+typedef struct quick_list {
     int length;             // Number of blocks currently in the list.
-    struct block *first;    // Pointer to first block in the list.
-} quick_lists[NUM_QUICK_LISTS];
+    heap_offset first;      // Offset of first block in the list.
+} quick_list;
+
+
+#define HEAP_MAGIC   0x4d454d4845415031ULL  /* "MEMHEAP1" */
+#define HEAP_VERSION 1
+
+/*
+ * Heap superblock, stored at heap_base in front of the prologue. It holds
+ * all allocator state that must survive a remap: the list heads and, for a
+ * file-backed heap, the break and the root object.
+ */
+typedef struct heap_super {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t clean;                             // Set while the file is closed cleanly.
+    heap_offset brk;                            // End of the heap, epilogue included.
+    heap_offset root;                           // Payload offset of the root object, 0 if none.
+    size_t quick_class_sizes[NUM_QUICK_LISTS];  // Size-class layout the lists were built with.
+    size_t seglist_limits[NUM_FREE_LISTS];
+    block free_list_heads[NUM_FREE_LISTS];      // Sentinels of the circular seglists.
+    quick_list quick_lists[NUM_QUICK_LISTS];
+} heap_super;
+
+extern size_t current_payload;     /* Live requested bytes; not kept with PERCPU_CACHE */
+extern char *heap_base;             /* Superblock of the current heap, NULL before init */
+extern block *free_list_heads;      /* NUM_FREE_LISTS sentinels inside the superblock */
+extern quick_list *quick_lists;     /* NUM_QUICK_LISTS heads inside the superblock */
 
 
 /*
@@ -49,6 +80,33 @@ struct {
 void *alloc(size_t size);
 
 
+/* Expected lifetime of a block, for alloc_hint; at most one may be given */
+#define ALLOC_HINT_NONE       0x0  /* Unknown: the main heap, same as alloc. */
+#define ALLOC_HINT_SHORT      0x1  /* Temporaries freed soon after allocation. */
+#define ALLOC_HINT_LONG       0x2  /* Objects that outlive many temporaries. */
+#define ALLOC_HINT_PERMANENT  0x4  /* Objects that are rarely or never freed. */
+#define ALLOC_HINT_MASK       0x7
+
+/*
+ * Allocates like alloc, but places the block in a separate heap region per
+ * lifetime hint, each with its own seglists and quick lists, so long-lived
+ * blocks do not pin the pages that short-lived ones are freed from.
+ * The result may be passed to freemem and reallocate like any other block;
+ * reallocate keeps it in its region, even while a file heap is open.
+ *
+ * Hints are ignored while a file heap is open (see pheap.h). A request
+ * whose region cannot be reserved or is exhausted, including a reallocate
+ * that grows a region block, is served from the main heap instead.
+ *
+ * @param size The number of bytes requested to be allocated.
+ * @param flags Exactly one of the ALLOC_HINT_* values.
+ *
+ * @return As for alloc. If flags combines several lifetimes or has unknown
+ * bits set, NULL is returned and errno is set to EINVAL.
+ */
+void *alloc_hint(size_t size, int flags);
+
+
 /*
  * Resizes the memory pointed to by ptr to size bytes.
  *
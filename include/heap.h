@@ -0,0 +1,56 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Switching the heap that alloc serves. Internal to the allocator: used by
+ * alloc.c and pheap.c only.
+ */
+
+/**
+ * Lays out a fresh heap at base: superblock, prologue, epilogue and one
+ * free block covering the rest of the first size bytes, then makes it the
+ * current heap.
+ *
+ * @param base Start of the heap memory (16-byte aligned)
+ * @param size Bytes available at base right now
+ * @param limit End of the address range the heap may grow into, NULL to
+ * grow with sbrk
+ */
+void format_heap(void *base, size_t size, void *limit);
+
+
+/**
+ * Makes an already formatted heap at base the current heap.
+ *
+ * @param base Start of the heap (its superblock)
+ * @param limit End of the address range the heap may grow into, NULL to
+ * grow with sbrk
+ */
+void attach_heap(void *base, void *limit);
+
+
+/**
+ * Forgets the current heap; the next alloc starts a new main heap.
+ */
+void detach_heap(void);
+
+
+/**
+ * @return true while pheap_open has a file heap in place of the main heap
+ */
+bool file_heap_open(void);
+
+
+#ifdef PERCPU_CACHE
+/**
+ * Returns every block held in the per-CPU caches to the current heap's
+ * lists, e.g. before the heap is unmapped. No other thread may be inside
+ * the allocator.
+ */
+void drain_cpu_caches(void);
+#endif
+
+#endif
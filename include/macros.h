@@ -12,6 +12,14 @@
 #define MAX(x, y) ((x) > (y)? (x) : (y))
 
 
+/* Diagnostics for pointer validation, compiled in only by `make debug` */
+#ifdef DEBUG
+#define debug(...) do { printf(__VA_ARGS__); fflush(NULL); } while (0)
+#else
+#define debug(...) do { } while (0)
+#endif
+
+
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc)  ((size) | (alloc))
 #define ALLOC_PACK(payload, block) (((uint64_t)(payload) << 32) | (block) | (THIS_BLOCK_ALLOCATED))
@@ -32,9 +40,16 @@
 #define GET_PAYLOAD(p)    ((((block *)p)->header) >> MIN_SIZE)
 
 
-/* Get next and prev free block from header */
-#define GET_NEXT(ptr) (((block *)ptr)->body.links.next)
-#define GET_PREV(ptr) (((block *)ptr)->body.links.prev)
+/* Convert between block pointers and free-list offsets from heap_base */
+#define TO_OFFSET(ptr) ((ptr) == NULL ? (heap_offset)0 : (heap_offset)((char *)(ptr) - heap_base))
+#define TO_BLOCK(off)  ((off) == 0 ? NULL : (block *)(heap_base + (off)))
+
+
+/* Get and set next and prev free block from header */
+#define GET_NEXT(ptr) TO_BLOCK(((block *)(ptr))->body.links.next)
+#define GET_PREV(ptr) TO_BLOCK(((block *)(ptr))->body.links.prev)
+#define SET_NEXT(ptr, val) (((block *)(ptr))->body.links.next = TO_OFFSET(val))
+#define SET_PREV(ptr, val) (((block *)(ptr))->body.links.prev = TO_OFFSET(val))
 
 
 /* assume block pointer is pointing to payload*/
@@ -51,8 +66,15 @@
 #define SET_ALLOC(ptr) ((ptr)->header = (((ptr)->header) | THIS_BLOCK_ALLOCATED) )
 
 
-/* Shorthand for getting next in free list header */
-#define FREE_LST_HEAD_NEXT(block_num) (free_list_heads[block_num].body.links.next)
-#define FREE_LST_HEAD_PREV(block_num) (free_list_heads[block_num].body.links.prev)
+/* Shorthand for the sentinel of a free list and its first and last blocks */
+#define FREE_LST_HEAD(block_num)      (free_list_heads + (block_num))
+#define FREE_LST_HEAD_NEXT(block_num) GET_NEXT(FREE_LST_HEAD(block_num))
+#define FREE_LST_HEAD_PREV(block_num) GET_PREV(FREE_LST_HEAD(block_num))
+
+
+/* Superblock of the current heap, and the offset of its first block */
+#define SUPER ((heap_super *)heap_base)
+#define HEAP_FIRST_BLOCK ((sizeof(heap_super) + ALIGNMENT_POINTERS - 1) / ALIGNMENT_POINTERS \
+                          * ALIGNMENT_POINTERS + DSIZE + MIN_SIZE)
 
 #endif
@@ -0,0 +1,52 @@
+#ifndef PERCPU_H
+#define PERCPU_H
+
+#include <stddef.h>
+
+/*
+ * Optional per-CPU front end for the quick list classes, built with
+ * -DPERCPU_CACHE (make PERCPU=1).
+ *
+ * Each CPU owns a small LIFO of free blocks per quick list class. Pops and
+ * pushes run inside Linux restartable sequences (rseq), so they need neither
+ * atomics nor locks: if the thread is preempted or migrated mid-operation the
+ * kernel restarts it. Cached memory is bounded by
+ * CPUs x NUM_QUICK_LISTS x PERCPU_LIST_MAX blocks, independent of the number
+ * of threads. Where rseq is unavailable every call reports a miss and the
+ * caller falls back to the locked heap.
+ */
+
+#define PERCPU_LIST_MAX 32  /* Maximum blocks per class cached on one CPU. */
+
+/**
+ * Pops a block from the current CPU's cache for a quick list class
+ *
+ * @param ql_index Quick list class of the block wanted
+ * @return Pointer to the header of a cached block, NULL if the cache is
+ * empty or rseq is unavailable
+ */
+void *percpu_pop(int ql_index);
+
+/**
+ * Pushes a block onto the current CPU's cache for a quick list class
+ *
+ * The block must already be marked IN_QUICK_LIST so the heap never
+ * coalesces it while it is cached.
+ *
+ * @param ql_index Quick list class of the block
+ * @param block_ptr Pointer to the header of the block
+ * @return 0 on success, -1 if the cache is full or rseq is unavailable
+ */
+int percpu_push(int ql_index, void *block_ptr);
+
+/**
+ * Takes a block from any CPU's cache for a quick list class, outside of
+ * rseq. No other thread may be inside the allocator.
+ *
+ * @param ql_index Quick list class of the block wanted
+ * @return Pointer to the header of a cached block (still marked
+ * IN_QUICK_LIST), NULL once every CPU's cache for the class is empty
+ */
+void *percpu_drain(int ql_index);
+
+#endif
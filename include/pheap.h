@@ -0,0 +1,76 @@
+#ifndef PHEAP_H
+#define PHEAP_H
+
+#include <stddef.h>
+
+/*
+ * Persistent heap backed by a memory-mapped file.
+ *
+ * While a file heap is open, alloc/freemem/reallocate serve it instead of
+ * the main heap. Block headers, footers and the superblock live in the file
+ * and the free lists are linked by offset, so the heap can be reopened later
+ * (by another process, at another address) with its allocated blocks and
+ * free lists intact. Objects should refer to each other with pheap_offset()
+ * rather than raw pointers for the same reason.
+ *
+ * A heap that was not closed with pheap_close (crash, kill) is marked dirty;
+ * reopening it walks every block and rebuilds the free lists from the block
+ * headers. None of these calls may run concurrently with other allocator
+ * calls.
+ */
+
+/**
+ * Opens (creating it if needed) a file heap and makes it the current heap
+ *
+ * Must be called before the first alloc or after pheap_close.
+ *
+ * @param path File that holds the heap
+ * @param capacity Size of the mapping, rounded up to a page. An existing
+ * file larger than capacity keeps its size; a smaller one is grown.
+ * @return 0 on success, -1 with errno set on failure: EBUSY if a heap is
+ * already in use, EINVAL if the file is not a valid heap
+ */
+int pheap_open(const char *path, size_t capacity);
+
+/**
+ * Flushes and unmaps the current file heap. Pointers into it are invalid
+ * afterwards; the next alloc starts a new main heap.
+ *
+ * @return 0 on success, -1 with errno set on failure
+ */
+int pheap_close(void);
+
+/**
+ * @return The payload registered with pheap_set_root, NULL if none
+ */
+void *pheap_root(void);
+
+/**
+ * Registers the entry point of the heap's object graph, found again with
+ * pheap_root after a reopen.
+ *
+ * @param ptr Payload returned by alloc, or NULL to clear the root
+ * @return 0 on success, -1 with errno set to EINVAL if there is no heap or
+ * ptr lies outside it
+ */
+int pheap_set_root(void *ptr);
+
+/**
+ * @return Position of ptr within the current heap, 0 for NULL
+ */
+size_t pheap_offset(const void *ptr);
+
+/**
+ * @return Pointer for a position returned by pheap_offset, NULL for 0
+ */
+void *pheap_ptr(size_t off);
+
+/**
+ * Walks every block of the current heap checking sizes, footers and the
+ * epilogue.
+ *
+ * @return 0 if the heap is consistent, -1 otherwise
+ */
+int pheap_check(void);
+
+#endif
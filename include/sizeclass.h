@@ -0,0 +1,26 @@
+#ifndef SIZECLASS_H
+#define SIZECLASS_H
+
+#include "alloc.h"
+#include "sizeclass_table.h"
+
+/*
+ * Size-class layout, generated at build time by tools/gen_sizeclass
+ * (see SIZE_PROFILE in the Makefile). Block sizes are multiples of 16, so
+ * the lookup tables are indexed by block_size >> 4.
+ */
+
+/* Block size of each quick list, ascending */
+extern const size_t quick_class_sizes[NUM_QUICK_LISTS];
+
+/* Largest block size held by each seglist; the last one is unbounded */
+extern const size_t seglist_limits[NUM_FREE_LISTS];
+
+extern const signed char quick_class_lookup[(QUICK_CLASS_MAX >> 4) + 1];
+extern const unsigned char seglist_lookup[(SIZECLASS_LOOKUP_MAX >> 4) + 1];
+
+/* Smallest quick list whose blocks fit block_size, -1 if none does */
+#define QUICK_FIT(block_size) \
+    ((block_size) <= QUICK_CLASS_MAX ? quick_class_lookup[((block_size) + 15) >> 4] : -1)
+
+#endif
@@ -1,100 +1,371 @@
 #include "alloc.h"
 #include "find.h"
+#include "heap.h"
 #include "macros.h"
 #include "seglist.h"
+#include "sizeclass.h"
 #include <errno.h>
+#include <sys/mman.h>
+
+#ifdef PERCPU_CACHE
+#include "percpu.h"
+#include <pthread.h>
+#endif
 
 
 /* global variables */
 static void *list_p           = 0;  /* Pointer to first block */
 static void *mem_brk          = 0;  /* Points to last byte of heap */
+static void *heap_limit       = 0;  /* End of a reservation or file mapping, NULL for sbrk */
+#ifndef PERCPU_CACHE
 static size_t max_payload     = 0;
+#endif
 size_t current_payload = 0;
+char *heap_base = NULL;
+block *free_list_heads = NULL;
+quick_list *quick_lists = NULL;
+
+/*
+ * The globals above describe the current heap. Outside of an allocator call
+ * that is always the main heap (sbrk, reservation or file); a lifetime
+ * region is made current only while the heap lock holder works on it.
+ */
+static char *main_base        = NULL;  /* Superblock of the main heap */
+static void *main_limit       = NULL;  /* Its heap_limit */
+
+#define REGION_RESERVE ((size_t)1 << 30)  /* Address space reserved per lifetime region */
+#define MAIN_RESERVE   ((size_t)1 << 34)  /* Reserved for the main heap with PERCPU_CACHE */
+static char *regions[ALLOC_HINT_MASK + 1];  /* Region per lifetime hint, NULL until used */
+
+
+/*
+ * With the per-CPU front end the allocator is shared between threads, so
+ * everything behind it (quick lists, seglists, heap growth) is serialized by
+ * one lock. The main heap then grows inside an mmap reservation instead of
+ * with sbrk: glibc's sbrk is not thread-safe, and glibc malloc may call it
+ * from another thread at any time.
+ */
+#ifdef PERCPU_CACHE
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+#define HEAP_LOCK()   pthread_mutex_lock(&heap_lock)
+#define HEAP_UNLOCK() pthread_mutex_unlock(&heap_lock)
+#else
+#define HEAP_LOCK()
+#define HEAP_UNLOCK()
+#endif
+
+
+/*
+ * Payload statistics. The per-CPU build does not keep them: its fast paths
+ * take no lock, so the counters could not be updated without racing.
+ */
+#ifdef PERCPU_CACHE
+#define ADD_PAYLOAD(n)
+#define SUB_PAYLOAD(n)
+#else
+#define ADD_PAYLOAD(n) do { current_payload += (n); \
+                            if(current_payload > max_payload) max_payload = current_payload; } while (0)
+#define SUB_PAYLOAD(n) (current_payload -= (n))
+#endif
+
+
+/* Address space for a heap to grow into; only touched pages are backed */
+static void *reserve(size_t bytes)
+{
+    void *base = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return base == MAP_FAILED ? NULL : base;
+}
 
 
 /**
  * Initializes the memory allocator
  * 
- * Creates the initial heap, sets up the prologue and epilogue blocks,
- * initializes the segregated free lists and quick lists, and creates the 
- * first free block.
+ * Creates the initial heap from sbrk (from a reservation with
+ * PERCPU_CACHE), sets up the superblock, prologue and
+ * epilogue blocks, initializes the segregated free lists and quick lists,
+ * and creates the first free block.
  * 
  * @return 0 on success, -1 on failure
  */
 int mm_init(void)
 {
-    if((list_p = sbrk(PAGE_SIZE)) == (void *)-1){errno = ENOMEM; return -1;}
+    void *base;
+#ifdef PERCPU_CACHE
+    if((base = reserve(MAIN_RESERVE)) == NULL){errno = ENOMEM; return -1;}
+
+    format_heap(base, PAGE_SIZE, (char *)base + MAIN_RESERVE);
+#else
+    if((base = sbrk(PAGE_SIZE)) == (void *)-1){errno = ENOMEM; return -1;}
+
+    format_heap(base, PAGE_SIZE, NULL);
+#endif
+    return 0;
+}
+
+
+/* Makes the heap at base current without changing the main heap */
+static void use_heap(char *base, void *limit)
+{
+    if (base == NULL)
+    {
+        heap_base = NULL;
+        free_list_heads = NULL;
+        quick_lists = NULL;
+        list_p = 0;
+        mem_brk = 0;
+        heap_limit = NULL;
+        return;
+    }
+
+    heap_base = base;
+    free_list_heads = SUPER->free_list_heads;
+    quick_lists = SUPER->quick_lists;
+    list_p = heap_base + HEAP_FIRST_BLOCK;
+    mem_brk = heap_base + SUPER->brk;
+    heap_limit = limit;
+}
+
+
+/* Lays out a fresh heap at base and makes it current, see format_heap */
+static void init_heap(void *base, size_t size, void *limit)
+{
+    heap_super *super = base;
+    memset(super, 0, sizeof(*super));
+    super->magic = HEAP_MAGIC;
+    super->version = HEAP_VERSION;
+    super->brk = size;
+    memcpy(super->quick_class_sizes, quick_class_sizes, sizeof(super->quick_class_sizes));
+    memcpy(super->seglist_limits, seglist_limits, sizeof(super->seglist_limits));
+
+    use_heap(base, limit);
 
     //initialize heads as circular doubly linked lists
     for(int i = 0; i < NUM_FREE_LISTS; i++)
     {
-        FREE_LST_HEAD_NEXT(i) = free_list_heads + i;
-        FREE_LST_HEAD_PREV(i) = free_list_heads + i;
+        SET_NEXT(FREE_LST_HEAD(i), FREE_LST_HEAD(i));
+        SET_PREV(FREE_LST_HEAD(i), FREE_LST_HEAD(i));
     }
 
     //initialize quick lists
     for(int i = 0; i < NUM_QUICK_LISTS; i++)
     {
         quick_lists[i].length = 0;
-        quick_lists[i].first = NULL;
+        quick_lists[i].first = 0;
     }
 
-    list_p = (char *)list_p + DSIZE; //unused for alignment
-    PUT(list_p, PACK(MIN_SIZE, 1));
-    PUT(FTRP_HEADER(list_p), PACK(MIN_SIZE, 1));
-
-    mem_brk = sbrk(0);
+    void *prologue = (char *)list_p - MIN_SIZE;
+    PUT(prologue, PACK(MIN_SIZE, 1));
+    PUT(FTRP_HEADER(prologue), PACK(MIN_SIZE, 1));
 
     PUT2W((char *)mem_brk - DSIZE, PACK(0, 1));
-    list_p += MIN_SIZE; //first block
 
     /* free block header */
     //size of free block is last address - first address - epilogue
     size_t free_block_size = (char *)mem_brk - (char *)list_p - DSIZE;
 
-    //Add free block to seglist
-    int block_num = min_seglist_block(ALIGN(free_block_size));
-
     ((block *)list_p)->header = PACK(free_block_size, 0); //header
     PUT2W(FTRP_HEADER(list_p), PACK(free_block_size, 0)); //footers
 
-    GET_NEXT(list_p) = free_list_heads + block_num;
-    GET_PREV(list_p) = free_list_heads + block_num;
-    FREE_LST_HEAD_PREV(block_num) = list_p;
-    FREE_LST_HEAD_NEXT(block_num) = list_p;
+    //Add free block to seglist
+    add_to_seglist(list_p);
+}
+
+
+void format_heap(void *base, size_t size, void *limit)
+{
+    init_heap(base, size, limit);
+    main_base = base;
+    main_limit = limit;
+}
+
+
+void attach_heap(void *base, void *limit)
+{
+    use_heap(base, limit);
+    main_base = base;
+    main_limit = limit;
+}
+
+
+void detach_heap(void)
+{
+    use_heap(NULL, NULL);
+    main_base = NULL;
+    main_limit = NULL;
+}
+
+
+/**
+ * Makes the region for a lifetime hint the current heap, reserving and
+ * formatting it on first use. Caller holds the heap lock and switches back
+ * with leave_region before releasing it.
+ *
+ * @return 0 on success, -1 if the region could not be reserved
+ */
+static int enter_region(int hint)
+{
+    if (regions[hint] == NULL)
+    {
+        void *base = reserve(REGION_RESERVE);
+        if (base == NULL) {errno = ENOMEM; return -1;}
+
+        init_heap(base, PAGE_SIZE, (char *)base + REGION_RESERVE);
+        regions[hint] = base;
+        return 0;
+    }
+
+    use_heap(regions[hint], regions[hint] + REGION_RESERVE);
     return 0;
 }
 
+static void leave_region(void)
+{
+    use_heap(main_base, main_limit);
+}
 
-void *alloc(size_t size)
+
+/* Lifetime hint of the region holding pp, ALLOC_HINT_NONE for the main heap */
+static int region_of(const void *pp)
 {
-    if (list_p == 0){
-        if(mm_init() == -1){
-            errno = ENOMEM;
-            return NULL;
-        }
+    for (int hint = ALLOC_HINT_SHORT; hint <= ALLOC_HINT_PERMANENT; hint <<= 1)
+    {
+        if (regions[hint] != NULL && (char *)pp >= regions[hint] &&
+            (char *)pp < regions[hint] + REGION_RESERVE)
+            return hint;
     }
+    return ALLOC_HINT_NONE;
+}
 
-    if (size == 0) return NULL;
 
-    size_t block_size;
+/**
+ * Grows the heap by incr bytes, from sbrk or from the rest of the mapping
+ *
+ * @return Old end of the heap memory, (void *)-1 if there is no more
+ */
+static void *more_core(size_t incr)
+{
+    if (heap_limit == NULL) return sbrk(incr);
+    if ((size_t)((char *)heap_limit - (char *)mem_brk) < incr) return (void *)-1;
+    return mem_brk;
+}
+
 
+static void *heap_alloc(size_t size, size_t block_size);
+static void *region_alloc(size_t size, int hint);
+static void heap_free(block *b);
+
+
+/* Block size that serves a request of size bytes */
+static size_t request_block_size(size_t size)
+{
     /*
     Block size must have:
         - at least 32 bytes
         - 8 byte header sizes, + payload size (size) + padding for alignment + 8 byte footer size
     */
-    block_size = ALIGN(size);
+    size_t block_size = ALIGN(size);
     if(block_size < MIN_SIZE) block_size = MIN_SIZE;
 
+    //round up to the quick list class so the block can be cached when freed
+    int ql_index = QUICK_FIT(block_size);
+    if(ql_index >= 0) block_size = quick_class_sizes[ql_index];
+
+    return block_size;
+}
+
+
+void *alloc(size_t size)
+{
+    if (size == 0) return NULL;
+
+    size_t block_size = request_block_size(size);
+    void *block_ptr;
+
+#ifdef PERCPU_CACHE
+    // Fast path: no lock, and no payload accounting (it is shared state)
+    int ql_index = QUICK_FIT(block_size);
+    if(ql_index >= 0 && (block_ptr = percpu_pop(ql_index)) != NULL)
+    {
+        PUT2W(block_ptr, ALLOC_PACK(size, block_size));
+        PUT2W(FTRP_HEADER(block_ptr), ALLOC_PACK(size, block_size));
+        return (char *)block_ptr + DSIZE;
+    }
+#endif
+
+    HEAP_LOCK();
+    block_ptr = heap_alloc(size, block_size);
+    HEAP_UNLOCK();
+    return block_ptr;
+}
+
+
+void *alloc_hint(size_t size, int flags)
+{
+    int hint = flags & ALLOC_HINT_MASK;
+    if ((flags & ~ALLOC_HINT_MASK) != 0 || (hint & (hint - 1)) != 0) //not a single lifetime
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    // A file heap keeps every new block, so that it persists
+    if (size == 0 || hint == ALLOC_HINT_NONE || file_heap_open()) return alloc(size);
+
+    return region_alloc(size, hint);
+}
+
+
+/**
+ * Allocates from the region for hint, or from the main heap if the region
+ * cannot be reserved or is exhausted.
+ *
+ * @return Pointer to the payload, NULL if no more memory
+ */
+static void *region_alloc(size_t size, int hint)
+{
+    size_t block_size = request_block_size(size);
+    void *block_ptr = NULL;
+    int saved_errno = errno;
+
+    // Hinted blocks bypass the per-CPU caches, which only hold main heap blocks
+    HEAP_LOCK();
+    if (enter_region(hint) == 0)
+    {
+        block_ptr = heap_alloc(size, block_size);
+        leave_region();
+    }
+    if (block_ptr == NULL) // region full: the ENOMEM it left is not ours to report
+    {
+        errno = saved_errno;
+        block_ptr = heap_alloc(size, block_size);
+    }
+    HEAP_UNLOCK();
+    return block_ptr;
+}
+
+
+/**
+ * Places a block of block_size for a payload of size, from the quick lists,
+ * the seglists or new heap memory. Caller holds the heap lock.
+ *
+ * @return Pointer to the payload, NULL if no more memory
+ */
+static void *heap_alloc(size_t size, size_t block_size)
+{
+    if (list_p == 0){
+        if(mm_init() == -1){
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
     void *block_ptr;
 
     if((block_ptr = find_quick_list(block_size)) != NULL)
     {
         PUT2W(block_ptr, (ALLOC_PACK(size, block_size) & ~IN_QUICK_LIST));
         PUT2W(FTRP_HEADER(block_ptr), (ALLOC_PACK(size, block_size) & ~IN_QUICK_LIST));
-        current_payload += size;
-        if(current_payload > max_payload) max_payload = current_payload;
+        ADD_PAYLOAD(size);
         return (char *)block_ptr + DSIZE; //block_ptr points to header, return pointer to payload
     }
     
@@ -108,8 +379,7 @@ void *alloc(size_t size)
     }
 
     allocate_block(block_ptr, block_size, size);
-    current_payload += size;
-    if(current_payload > max_payload) max_payload = current_payload;
+    ADD_PAYLOAD(size);
     return (char *)block_ptr + DSIZE;
 }
 
@@ -136,8 +406,12 @@ void *reallocate(void *pp, size_t rsize) {
     }
     else if(rsize > payload)
     {
-        size_t temp_max_payload = max_payload;
-        if((ptr = alloc(rsize)) == NULL)
+#ifndef PERCPU_CACHE
+        size_t temp_max_payload = max_payload; //old and new block are never both live
+#endif
+        int hint = region_of(pp);
+        ptr = hint != ALLOC_HINT_NONE ? region_alloc(rsize, hint) : alloc(rsize); //stay in the same region
+        if(ptr == NULL)
         {
             errno = ENOMEM;
             return NULL;
@@ -145,20 +419,23 @@ void *reallocate(void *pp, size_t rsize) {
         memcpy(ptr, pp, payload);
 
         freemem(pp);
+#ifndef PERCPU_CACHE
         max_payload = temp_max_payload;
         if(current_payload > max_payload) max_payload = current_payload;
+#endif
         return ptr;
     }
     else
     {
+        int hint = region_of(pp);
+        HEAP_LOCK();
+        if (hint != ALLOC_HINT_NONE) enter_region(hint);
         size_t aligned_size = ALIGN(rsize);
-        current_payload -= payload - rsize;
-        if(current_payload > max_payload) max_payload = current_payload;
+        SUB_PAYLOAD(payload - rsize);
         if(size - aligned_size < MIN_SIZE)
         {
             PUT2W(HDRP(pp), ALLOC_PACK(rsize, size));
             PUT2W(FTRP(pp), ALLOC_PACK(rsize, size));
-            return pp;
         }
         else
         {
@@ -170,8 +447,10 @@ void *reallocate(void *pp, size_t rsize) {
             PUT2W(free_block, PACK(size - aligned_size, 0));
             PUT2W(FTRP_HEADER(free_block), PACK(size - aligned_size, 0));
             add_to_seglist(coalesce(free_block));
-            return pp;
         }
+        if (hint != ALLOC_HINT_NONE) leave_region();
+        HEAP_UNLOCK();
+        return pp;
     }
 }
 
@@ -181,15 +460,32 @@ void *extend_heap(size_t size)
     void *block_ptr;
     size_t new_size;
 
-    new_size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    //leave room for a fence word in case the break was moved by someone else
+    new_size = (size + 2*DSIZE + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
 
-    if ((block_ptr = sbrk(new_size)) == (void *)-1) {
+    if ((block_ptr = more_core(new_size)) == (void *)-1) {
         errno = ENOMEM;
         return NULL;
     }
+    void *old_brk = mem_brk;
+    mem_brk = (char *)block_ptr + new_size;
+    SUPER->brk = (char *)mem_brk - heap_base;
 
-    mem_brk = sbrk(0);
-
+    if (block_ptr == old_brk)
+    {
+        block_ptr = (char *)block_ptr - DSIZE; //new block starts on the old epilogue
+    }
+    else
+    {
+        /*
+        libc (or anyone else) called sbrk since our last extension, so the new
+        memory is not adjacent to our heap. Fence it off with an allocated word
+        so coalesce never looks at the foreign memory below it.
+        */
+        PUT2W((char *)block_ptr, PACK(0, 1));
+        block_ptr = (char *)block_ptr + DSIZE;
+        new_size -= 2*DSIZE;
+    }
 
     PUT2W((char *)block_ptr, PACK(new_size, 0)); // header
     PUT2W(FTRP_HEADER((char *)block_ptr), PACK(new_size, 0)); //footer
@@ -209,74 +505,75 @@ void *extend_heap(size_t size)
 
 int validate_free_ptr(void *pp)
 {
-    printf("test: %p\n", pp);
+    debug("test: %p\n", pp);
     if(pp == NULL || pp == 0 || pp == (void *)-1) // null ptr
     {
-        printf("null");
-        fflush(NULL);
+        debug("null");
         return -1;
     }
-    if(pp < list_p || pp > mem_brk) //not in heap
+    // Bounds of the heap pp belongs to; the current heap may be another region
+    int hint = region_of(pp);
+    char *base = hint != ALLOC_HINT_NONE ? regions[hint] : main_base;
+    if(base == NULL) //no heap yet
     {
-        printf("not in heap");
+        debug("no heap");
+        return -1;
+    }
+    char *first = base + HEAP_FIRST_BLOCK;
+    char *end = base + ((heap_super *)base)->brk;
+
+    if((char *)pp < first || (char *)pp > end) //not in heap
+    {
+        debug("not in heap");
         return -1;
     }
     if(((uintptr_t)pp & (DSIZE - 1)) != 0) //ptr not aligned
     {
-        printf("not aligned");
-        fflush(NULL);
+        debug("not aligned");
         return -1;
     }
 
     block *block_ptr = (block *)((char *)pp - DSIZE); // already free
     if(!((block_ptr->header) & THIS_BLOCK_ALLOCATED))
     {
-        printf("already free");
-        fflush(NULL);
+        debug("already free");
         return -1;
     }
     if(((block_ptr->header) & IN_QUICK_LIST)) // in quick list
     {
-        printf("in ql");
-        fflush(NULL);
+        debug("in ql");
         return -1;
     }
 
     header *footer = (header *)(FTRP_HEADER(block_ptr));
     if((*footer) != (block_ptr->header)) //Footer and header don't match
     {
-        printf("ftr and hdr dont match");
-        fflush(NULL);
+        debug("ftr and hdr dont match");
         return -1;
     }
 
     size_t size = GET_BLOCKSIZE(block_ptr);
     if(size < MIN_SIZE) // Size is less than minimum
     {
-        printf("size is less than min");
-        fflush(NULL);
+        debug("size is less than min");
         return -1;
     }
     if((size & 0xF) != 0) //Size is not a multiple of 16
     {
-        printf("size is not mult of 16");
-        fflush(NULL);
+        debug("size is not mult of 16");
         return -1;
     }
-    if((char *)footer >= (char *)mem_brk - DSIZE) //Footer is after or on epilogue
+    if((char *)footer >= end - DSIZE) //Footer is after or on epilogue
     {
-        printf("footer after epilogue");
-        fflush(NULL);
+        debug("footer after epilogue");
         return -1;
     }
-    if((char *)block_ptr < (char *)list_p) //block_ptr is on prologue or before it
+    if((char *)block_ptr < first) //block_ptr is on prologue or before it
     {
-        printf("block_ptr is on or b4 prologue");
-        fflush(NULL);
+        debug("block_ptr is on or b4 prologue");
         return -1;
     }
-    printf("works?");
-    fflush(NULL);
+    debug("works?");
     return 0;
 }
 
@@ -311,7 +608,7 @@ void *coalesce(void *block_ptr)
 {
     size_t prev_alloc = (*((header *)((char *)block_ptr - DSIZE))) & THIS_BLOCK_ALLOCATED;
     size_t size = GET_BLOCKSIZE(block_ptr);
-    size_t next_alloc = (*((header *)((char *)block_ptr + size - DSIZE))) & THIS_BLOCK_ALLOCATED;
+    size_t next_alloc = (*((header *)((char *)block_ptr + size))) & THIS_BLOCK_ALLOCATED;
     //Case 1, in between two allocs
     if(prev_alloc && next_alloc) 
         return block_ptr;
@@ -363,29 +660,81 @@ void freemem(void *pp) {
     if(valid) abort();
 
     block *b = (block *)((char *)pp - DSIZE);
+    int hint = region_of(pp);
+
+#ifdef PERCPU_CACHE
     size_t block_size = GET_BLOCKSIZE(b);
-    current_payload -= block_size;
+    int ql_index = QUICK_FIT(block_size);
+    if (hint == ALLOC_HINT_NONE && ql_index >= 0 && quick_class_sizes[ql_index] == block_size)
+    {
+        // Marked before the push so the heap never coalesces a cached block
+        SET_QUICK(b);
+        PUT2W(FTRP_HEADER(b), b->header); //footer
+        if (percpu_push(ql_index, b) == 0) return;
+
+        b->header = ((b->header) & ~IN_QUICK_LIST);
+        PUT2W(FTRP_HEADER(b), b->header); //footer
+    }
+#endif
+
+    HEAP_LOCK();
+    if (hint != ALLOC_HINT_NONE) enter_region(hint);
+    heap_free(b);
+    if (hint != ALLOC_HINT_NONE) leave_region();
+    HEAP_UNLOCK();
+}
 
-    // Check if block should be added to a quick list
-    if (block_size <= (MIN_SIZE + (NUM_QUICK_LISTS - 1) * 16))
+
+#ifdef PERCPU_CACHE
+void drain_cpu_caches(void)
+{
+    HEAP_LOCK();
+    for (int i = 0; i < NUM_QUICK_LISTS; i++)
     {
-        int ql_index = (block_size - MIN_SIZE) / 16;
+        block *b;
+        while ((b = percpu_drain(i)) != NULL)
+        {
+            // Cached blocks are allocated blocks marked quick; free them normally
+            b->header = ((b->header) & ~IN_QUICK_LIST);
+            PUT2W(FTRP_HEADER(b), b->header); //footer
+            heap_free(b);
+        }
+    }
+    HEAP_UNLOCK();
+}
+#endif
+
 
+/**
+ * Returns a block to a quick list or, coalesced, to the seglists.
+ * Caller holds the heap lock.
+ *
+ * @param b Pointer to the header of a validated, allocated block
+ */
+static void heap_free(block *b)
+{
+    size_t block_size = GET_BLOCKSIZE(b);
+    SUB_PAYLOAD(GET_PAYLOAD(b)); //alloc counts the requested size, not the block
+
+    // Check if block should be added to a quick list (exact class size only)
+    int ql_index = QUICK_FIT(block_size);
+    if (ql_index >= 0 && quick_class_sizes[ql_index] == block_size)
+    {
         // Check if quick list isn't full
         if (quick_lists[ql_index].length < QUICK_LIST_MAX)
         {
             SET_QUICK(b);
-            PUT2W(FTRP(pp), b->header); //footer
-            GET_NEXT(b) = quick_lists[ql_index].first;
+            PUT2W(FTRP_HEADER(b), b->header); //footer
+            SET_NEXT(b, TO_BLOCK(quick_lists[ql_index].first));
 
-            quick_lists[ql_index].first = b;
+            quick_lists[ql_index].first = TO_OFFSET(b);
             quick_lists[ql_index].length++;
             return;
         }
         else
         {
             //Flush quicklist
-            block *current = quick_lists[ql_index].first;
+            block *current = TO_BLOCK(quick_lists[ql_index].first);
             block *next;
 
             while(current != NULL)
@@ -400,7 +749,7 @@ void freemem(void *pp) {
                 current = next;
             }
             // reset
-            quick_lists[ql_index].first = NULL;
+            quick_lists[ql_index].first = 0;
             quick_lists[ql_index].length = 0;
 
             /*
@@ -410,8 +759,8 @@ void freemem(void *pp) {
             */
             SET_QUICK(b);
             PUT2W(FTRP_HEADER(b), b->header); //set quick for footer
-            b->body.links.next = NULL;
-            quick_lists[ql_index].first = b;
+            SET_NEXT(b, NULL);
+            quick_lists[ql_index].first = TO_OFFSET(b);
             quick_lists[ql_index].length = 1;
             return;
         }
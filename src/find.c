@@ -1,6 +1,7 @@
 #include "alloc.h"
 #include "macros.h"
 #include "find.h"
+#include "sizeclass.h"
 
 void *find_list(size_t block_size)
 {
@@ -15,14 +16,14 @@ void *find_list(size_t block_size)
     {
         block_ptr = FREE_LST_HEAD_NEXT(block_num);
 
-        while(block_ptr != free_list_heads + block_num)
+        while(block_ptr != FREE_LST_HEAD(block_num))
         {
             //Compare free block size with needed block size
             //Free block size already takes into account header and footer
             size_t fb_size = GET_BLOCKSIZE(block_ptr);
 
             if(block_size <= fb_size) return (void *)block_ptr;
-            block_ptr = ((block *)block_ptr)->body.links.next;
+            block_ptr = GET_NEXT(block_ptr);
         }
     }
 
@@ -31,15 +32,15 @@ void *find_list(size_t block_size)
 
 void *find_quick_list(size_t block_size)
 {
-    if(block_size > (MIN_SIZE + (NUM_QUICK_LISTS - 1) * 16))
-        return NULL; //too big for quick list
+    int ql_index = QUICK_FIT(block_size);
+    if(ql_index < 0 || quick_class_sizes[ql_index] != block_size)
+        return NULL; //not a quick list size
 
-    int ql_index = (block_size - MIN_SIZE) / 16;
     if (quick_lists[ql_index].length == 0) return NULL;
 
-    block *b = quick_lists[ql_index].first;
+    block *b = TO_BLOCK(quick_lists[ql_index].first);
 
-    quick_lists[ql_index].first = GET_NEXT(b);
+    quick_lists[ql_index].first = b->body.links.next;
     quick_lists[ql_index].length--;
 
     b->header = ((b->header) & ~IN_QUICK_LIST);
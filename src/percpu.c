@@ -0,0 +1,229 @@
+#ifdef PERCPU_CACHE
+
+#include "alloc.h"
+#include "percpu.h"
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/rseq.h>
+
+#define RSEQ_SIG 0x53053053  /* Signature preceding every abort handler. */
+
+#define STR_(x) #x
+#define STR(x)  STR_(x)
+
+/* Set by glibc >= 2.35 when it registered rseq for each thread itself */
+extern const ptrdiff_t __rseq_offset __attribute__((weak));
+extern const unsigned int __rseq_size __attribute__((weak));
+
+typedef struct cpu_cache {
+    block *heads[NUM_QUICK_LISTS];  // Free blocks; depth kept in links.prev.
+} __attribute__((aligned(64))) cpu_cache;
+
+static cpu_cache *caches;
+static long num_cpus;
+static pthread_once_t caches_once = PTHREAD_ONCE_INIT;
+
+static __thread struct rseq *rseq_area;
+static __thread int rseq_state;         // 0 until the first call, then 1 or -1.
+static __thread struct rseq own_rseq;   // Used when libc did not register one.
+
+
+/* Caches come from mmap so the front end never touches the sbrk heap */
+static void init_caches(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_CONF);
+    if (n <= 0) return;
+
+    void *p = mmap(NULL, n * sizeof(cpu_cache), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return;  // num_cpus stays 0, so every call misses
+
+    caches = p;
+    num_cpus = n;
+}
+
+/**
+ * Finds the calling thread's rseq area, registering one if libc has not
+ *
+ * @return The thread's struct rseq, NULL if rseq is unavailable
+ */
+static struct rseq *current_rseq(void)
+{
+    if (rseq_state == 0)
+    {
+        pthread_once(&caches_once, init_caches);
+
+        if (&__rseq_size != NULL && __rseq_size > 0)
+            rseq_area = (struct rseq *)((char *)__builtin_thread_pointer() + __rseq_offset);
+#ifdef __NR_rseq
+        else if (syscall(__NR_rseq, &own_rseq, sizeof(own_rseq), 0, RSEQ_SIG) == 0)
+            rseq_area = &own_rseq;
+#endif
+        rseq_state = rseq_area != NULL ? 1 : -1;
+    }
+    return rseq_area;
+}
+
+/* CPU the thread last ran on, -1 if it has no cache */
+static long current_cpu(struct rseq *rs)
+{
+    long cpu = (int)*(volatile __u32 *)&rs->cpu_id;
+    return cpu >= 0 && cpu < num_cpus ? cpu : -1;
+}
+
+
+void *percpu_drain(int ql_index)
+{
+    for (long cpu = 0; cpu < num_cpus; cpu++)
+    {
+        block *b = caches[cpu].heads[ql_index];
+        if (b == NULL) continue;
+
+        caches[cpu].heads[ql_index] = (block *)b->body.links.next;
+        return b;
+    }
+    return NULL;
+}
+
+
+#if defined(__x86_64__)
+
+/*
+ * Critical section descriptor (start, length, abort handler) and the abort
+ * handler itself, laid out as the kernel expects. Labels: 1 start,
+ * 2 post-commit, 3 descriptor, 4 abort.
+ */
+#define RSEQ_CS_TABLE                                   \
+    ".pushsection __rseq_cs, \"aw\"\n\t"                \
+    ".balign 32\n\t"                                    \
+    "3:\n\t"                                            \
+    ".long 0x0, 0x0\n\t"                                \
+    ".quad 1f, (2f - 1f), 4f\n\t"                       \
+    ".popsection\n\t"
+
+#define RSEQ_CS_START                                   \
+    "leaq 3b(%%rip), %%rax\n\t"                         \
+    "movq %%rax, %[rseq_cs]\n\t"                        \
+    "1:\n\t"                                            \
+    "cmpl %[cpu], %[cpu_id]\n\t"                        \
+    "jnz 4f\n\t"
+
+#define RSEQ_CS_ABORT(label)                            \
+    ".pushsection __rseq_failure, \"ax\"\n\t"           \
+    ".byte 0x0f, 0xb9, 0x3d\n\t"                        \
+    ".long " STR(RSEQ_SIG) "\n\t"                       \
+    "4:\n\t"                                            \
+    "jmp %l[" #label "]\n\t"                            \
+    ".popsection\n\t"
+
+
+void *percpu_pop(int ql_index)
+{
+    struct rseq *rs = current_rseq();
+    if (rs == NULL) return NULL;
+
+    block *b;
+    block **out = &b;
+    for (;;)
+    {
+        long cpu = current_cpu(rs);
+        if (cpu < 0) return NULL;
+        block **head = &caches[cpu].heads[ql_index];
+
+        // b = *head; *head = b->next, committed by the final store.
+        __asm__ __volatile__ goto (
+            RSEQ_CS_TABLE
+            RSEQ_CS_START
+            "movq %[head], %%rbx\n\t"
+            "testq %%rbx, %%rbx\n\t"
+            "jz %l[empty]\n\t"
+            "movq %%rbx, %[out]\n\t"
+            "movq %c[next](%%rbx), %%rbx\n\t"
+            "movq %%rbx, %[head]\n\t"
+            "2:\n\t"
+            RSEQ_CS_ABORT(restart)
+            :
+            : [cpu] "r" ((int)cpu),
+              [cpu_id] "m" (rs->cpu_id),
+              [rseq_cs] "m" (rs->rseq_cs),
+              [head] "m" (*head),
+              [out] "m" (*out),
+              [next] "i" (offsetof(block, body.links.next))
+            : "memory", "cc", "rax", "rbx"
+            : restart, empty
+        );
+        return b;
+    restart:
+        continue;  // Preempted, signalled or migrated; retry on the new CPU.
+    empty:
+        return NULL;
+    }
+}
+
+int percpu_push(int ql_index, void *block_ptr)
+{
+    struct rseq *rs = current_rseq();
+    if (rs == NULL) return -1;
+
+    for (;;)
+    {
+        long cpu = current_cpu(rs);
+        if (cpu < 0) return -1;
+        block **head = &caches[cpu].heads[ql_index];
+
+        // Link block_ptr in front of *head with depth + 1, committed by the
+        // final store. Stores to block_ptr itself are private until then.
+        __asm__ __volatile__ goto (
+            RSEQ_CS_TABLE
+            RSEQ_CS_START
+            "movq %[head], %%rbx\n\t"
+            "xorl %%ecx, %%ecx\n\t"
+            "testq %%rbx, %%rbx\n\t"
+            "jz 5f\n\t"
+            "movq %c[depth](%%rbx), %%rcx\n\t"
+            "cmpq %[max], %%rcx\n\t"
+            "jae %l[full]\n\t"
+            "5:\n\t"
+            "incq %%rcx\n\t"
+            "movq %%rbx, %c[next](%[b])\n\t"
+            "movq %%rcx, %c[depth](%[b])\n\t"
+            "movq %[b], %[head]\n\t"
+            "2:\n\t"
+            RSEQ_CS_ABORT(restart)
+            :
+            : [cpu] "r" ((int)cpu),
+              [cpu_id] "m" (rs->cpu_id),
+              [rseq_cs] "m" (rs->rseq_cs),
+              [head] "m" (*head),
+              [b] "r" (block_ptr),
+              [max] "i" (PERCPU_LIST_MAX),
+              [next] "i" (offsetof(block, body.links.next)),
+              [depth] "i" (offsetof(block, body.links.prev))
+            : "memory", "cc", "rax", "rbx", "rcx"
+            : restart, full
+        );
+        return 0;
+    restart:
+        continue;
+    full:
+        return -1;
+    }
+}
+
+#else
+
+/* No rseq critical sections for this architecture: always fall back */
+void *percpu_pop(int ql_index)
+{
+    return NULL;
+}
+
+int percpu_push(int ql_index, void *block_ptr)
+{
+    return -1;
+}
+
+#endif /* __x86_64__ */
+
+#endif /* PERCPU_CACHE */
@@ -0,0 +1,268 @@
+#include "pheap.h"
+#include "alloc.h"
+#include "heap.h"
+#include "macros.h"
+#include "seglist.h"
+#include "sizeclass.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+static int heap_fd = -1;        /* File of the open heap, -1 if none */
+static size_t heap_size = 0;    /* Length of its mapping */
+
+
+/* True if a free list link points at a sentinel or a block below the break */
+static bool valid_link(heap_offset off)
+{
+    heap_offset heads = (char *)free_list_heads - heap_base;
+    if (off >= heads && off < heads + sizeof(SUPER->free_list_heads))
+        return (off - heads) % sizeof(block) == 0;
+    return off >= HEAP_FIRST_BLOCK && off < SUPER->brk && (off & 0xF) == DSIZE;
+}
+
+
+/**
+ * Cheap check that the lists of a cleanly closed heap are usable: the
+ * epilogue is in place and every head links into the heap.
+ *
+ * @return 0 if the lists can be trusted, -1 if they must be rebuilt
+ */
+static int check_lists(void)
+{
+    if (GET2W(heap_base + SUPER->brk - DSIZE) != (char *)PACK(0, 1)) return -1;
+
+    for (int i = 0; i < NUM_FREE_LISTS; i++)
+    {
+        if (!valid_link(FREE_LST_HEAD(i)->body.links.next)) return -1;
+        if (!valid_link(FREE_LST_HEAD(i)->body.links.prev)) return -1;
+    }
+    for (int i = 0; i < NUM_QUICK_LISTS; i++)
+    {
+        heap_offset first = quick_lists[i].first;
+        if (first != 0 && !valid_link(first)) return -1;
+        if (quick_lists[i].length < 0 || quick_lists[i].length > QUICK_LIST_MAX) return -1;
+    }
+    return 0;
+}
+
+
+int pheap_check(void)
+{
+    if (heap_base == NULL) return -1;
+
+    char *end = heap_base + SUPER->brk - DSIZE; // epilogue
+    char *p = heap_base + HEAP_FIRST_BLOCK;
+
+    while (p < end)
+    {
+        size_t size = GET_BLOCKSIZE(p);
+        if (size < MIN_SIZE || (size & 0xF) != 0) return -1;
+        if (size > (size_t)(end - p)) return -1;
+        if (GET2W(FTRP_HEADER(p)) != GET2W(p)) return -1; // footer mismatch
+        p += size;
+    }
+
+    if (p != end || GET2W(end) != (char *)PACK(0, 1)) return -1;
+    return 0;
+}
+
+
+/*
+ * Rebuilds the seglists from the block headers after an unclean shutdown.
+ * Runs of free and quick-listed blocks (including blocks that were sitting
+ * in per-CPU caches at the crash) are merged into single free blocks and
+ * the quick lists start out empty. The heap must have passed pheap_check.
+ */
+static void rebuild_lists(void)
+{
+    for (int i = 0; i < NUM_FREE_LISTS; i++)
+    {
+        SET_NEXT(FREE_LST_HEAD(i), FREE_LST_HEAD(i));
+        SET_PREV(FREE_LST_HEAD(i), FREE_LST_HEAD(i));
+    }
+    for (int i = 0; i < NUM_QUICK_LISTS; i++)
+    {
+        quick_lists[i].length = 0;
+        quick_lists[i].first = 0;
+    }
+
+    char *end = heap_base + SUPER->brk - DSIZE;
+    char *p = heap_base + HEAP_FIRST_BLOCK;
+    char *run = NULL; // start of the current run of free blocks
+
+    while (p <= end)
+    {
+        header h = ((block *)p)->header;
+        bool is_free = p < end && (!(h & THIS_BLOCK_ALLOCATED) || (h & IN_QUICK_LIST));
+
+        if (is_free && run == NULL) run = p;
+        if (!is_free && run != NULL)
+        {
+            size_t size = p - run;
+            PUT2W(run, PACK(size, 0)); //header
+            PUT2W(FTRP_HEADER(run), PACK(size, 0)); //footer
+            add_to_seglist(run);
+            run = NULL;
+        }
+        if (p == end) break;
+        p += GET_BLOCKSIZE(p);
+    }
+
+    memcpy(SUPER->quick_class_sizes, quick_class_sizes, sizeof(SUPER->quick_class_sizes));
+    memcpy(SUPER->seglist_limits, seglist_limits, sizeof(SUPER->seglist_limits));
+}
+
+
+/* Validates and attaches an existing heap of size bytes at base */
+static int open_existing(char *base, size_t size)
+{
+    heap_super *super = (heap_super *)base;
+    if (super->magic != HEAP_MAGIC || super->version != HEAP_VERSION ||
+        super->brk < HEAP_FIRST_BLOCK + MIN_SIZE + DSIZE || super->brk > size ||
+        (super->brk & 0xF) != 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    attach_heap(base, base + size);
+
+    // The lists were built for one size-class layout; a rebuild re-sorts them
+    bool same_layout =
+        memcmp(super->quick_class_sizes, quick_class_sizes, sizeof(super->quick_class_sizes)) == 0 &&
+        memcmp(super->seglist_limits, seglist_limits, sizeof(super->seglist_limits)) == 0;
+
+    if (!super->clean || !same_layout || check_lists() == -1)
+    {
+        if (pheap_check() == -1)
+        {
+            detach_heap();
+            errno = EINVAL;
+            return -1;
+        }
+        rebuild_lists();
+    }
+    return 0;
+}
+
+
+int pheap_open(const char *path, size_t capacity)
+{
+    if (heap_base != NULL || heap_fd != -1)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd == -1) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) goto fail;
+
+    bool fresh = st.st_size == 0;
+    size_t size = (capacity + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+    if ((size_t)st.st_size > size) size = st.st_size;
+    if (size < 2 * PAGE_SIZE)
+    {
+        errno = EINVAL;
+        goto fail;
+    }
+    if ((size_t)st.st_size < size && ftruncate(fd, size) == -1) goto fail;
+
+    char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) goto fail;
+
+    if (fresh)
+        format_heap(base, PAGE_SIZE, base + size);
+    else if (open_existing(base, size) == -1)
+    {
+        int err = errno;
+        munmap(base, size);
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    SUPER->clean = 0; // dirty until pheap_close
+    heap_fd = fd;
+    heap_size = size;
+    return 0;
+
+fail:;
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+}
+
+
+int pheap_close(void)
+{
+    if (heap_fd == -1)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+#ifdef PERCPU_CACHE
+    drain_cpu_caches(); // cached blocks point into the mapping
+#endif
+    SUPER->clean = 1;
+
+    int ret = msync(heap_base, heap_size, MS_SYNC);
+    munmap(heap_base, heap_size);
+    if (close(heap_fd) == -1) ret = -1;
+
+    detach_heap();
+    heap_fd = -1;
+    heap_size = 0;
+    return ret;
+}
+
+
+bool file_heap_open(void)
+{
+    return heap_fd != -1;
+}
+
+
+void *pheap_root(void)
+{
+    if (heap_base == NULL || SUPER->root == 0) return NULL;
+    return heap_base + SUPER->root;
+}
+
+
+int pheap_set_root(void *ptr)
+{
+    if (heap_base == NULL)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (ptr != NULL && ((char *)ptr < heap_base + HEAP_FIRST_BLOCK ||
+                        (char *)ptr >= heap_base + SUPER->brk))
+    {
+        errno = EINVAL; // e.g. a block from a lifetime region
+        return -1;
+    }
+
+    SUPER->root = pheap_offset(ptr);
+    return 0;
+}
+
+
+size_t pheap_offset(const void *ptr)
+{
+    return ptr == NULL ? 0 : (size_t)((const char *)ptr - heap_base);
+}
+
+
+void *pheap_ptr(size_t off)
+{
+    return off == 0 ? NULL : heap_base + off;
+}
@@ -1,22 +1,17 @@
 #include "seglist.h"
 #include "macros.h"
 #include "alloc.h"
+#include "sizeclass.h"
 
 
 int min_seglist_block(size_t block_size)
 {
-    if (block_size == MIN_SIZE) return 0;
+    if (block_size <= SIZECLASS_LOOKUP_MAX)
+        return seglist_lookup[(block_size + 15) >> 4];
 
-    size_t new_size = (block_size + MIN_SIZE - 1) / MIN_SIZE; // Ceiling division
-    new_size -= 1;
-
-    int i = 0;
-    while (new_size > 0)
-    {
-        new_size >>= 1;
-        i++;
-        if(i >= NUM_FREE_LISTS - 1) break;
-    }
+    // Past the lookup table, walk the remaining limits; the last is SIZE_MAX
+    int i = seglist_lookup[SIZECLASS_LOOKUP_MAX >> 4];
+    while (block_size > seglist_limits[i]) i++;
 
     return i;
 }
@@ -28,10 +23,10 @@ void add_to_seglist(void *free_ptr)
 
     // no need to check if list is first or not
     // this implementation works for both cases I believe
-    GET_NEXT(free_ptr) = FREE_LST_HEAD_NEXT(seglist_index);
-    GET_PREV(free_ptr) = free_list_heads + seglist_index;
-    GET_PREV(FREE_LST_HEAD_NEXT(seglist_index)) = free_ptr;
-    FREE_LST_HEAD_NEXT(seglist_index) = free_ptr;
+    SET_NEXT(free_ptr, FREE_LST_HEAD_NEXT(seglist_index));
+    SET_PREV(free_ptr, FREE_LST_HEAD(seglist_index));
+    SET_PREV(FREE_LST_HEAD_NEXT(seglist_index), free_ptr);
+    SET_NEXT(FREE_LST_HEAD(seglist_index), free_ptr);
 }
 
 
@@ -40,9 +35,9 @@ void remove_from_seglist(void *free_ptr)
     block *next = GET_NEXT(free_ptr);
     block *prev = GET_PREV(free_ptr);
 
-    prev->body.links.next = next;
-    next->body.links.prev = prev;
+    SET_NEXT(prev, next);
+    SET_PREV(next, prev);
 
-    GET_NEXT(free_ptr) = NULL;
-    GET_PREV(free_ptr) = NULL;
+    SET_NEXT(free_ptr, NULL);
+    SET_PREV(free_ptr, NULL);
 }
\ No newline at end of file
@@ -0,0 +1,7 @@
+#include "sizeclass.h"
+
+const size_t quick_class_sizes[NUM_QUICK_LISTS] = QUICK_CLASS_SIZES_INIT;
+const size_t seglist_limits[NUM_FREE_LISTS] = SEGLIST_LIMITS_INIT;
+
+const signed char quick_class_lookup[(QUICK_CLASS_MAX >> 4) + 1] = QUICK_CLASS_LOOKUP_INIT;
+const unsigned char seglist_lookup[(SIZECLASS_LOOKUP_MAX >> 4) + 1] = SEGLIST_LOOKUP_INIT;
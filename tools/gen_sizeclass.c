@@ -0,0 +1,313 @@
+#include "alloc.h"
+#include "macros.h"
+#include <errno.h>
+#include <math.h>
+
+/*
+ * Size-class table generator.
+ *
+ * Reads a histogram of requested sizes (the size argument passed to alloc)
+ * and writes sizeclass_table.h to stdout. Each input line is
+ *
+ *   <size> [count]
+ *
+ * with count defaulting to 1, so a plain trace of sizes works as well.
+ * Blank lines and lines starting with '#' are ignored. With no input file
+ * the historical layout is emitted: quick lists every 16 bytes from
+ * MIN_SIZE and power-of-two seglists.
+ *
+ * Quick classes: NUM_QUICK_LISTS block sizes up to the -q limit, chosen by
+ * dynamic programming to minimize
+ *
+ *   sum(count * padding) + penalty * (count of requests left to the seglists)
+ *
+ * where padding is the gap between a request's block and the class it is
+ * rounded up to, and penalty (-p) is what one seglist search is worth in
+ * bytes of padding.
+ *
+ * Seglist bounds: start from the power-of-two layout and, for the most
+ * frequent sizes the quick lists do not serve, move the nearest bounds onto
+ * that size and 16 bytes below it, so those requests get an exact-fit list.
+ *
+ * Usage: gen_sizeclass [-q quick_max] [-p penalty] [histogram]
+ */
+
+#define LOOKUP_MAX        4096      /* Block sizes resolved by direct lookup */
+#define MAX_TRACKED       (1 << 20) /* Larger requests are all "large" */
+#define DEFAULT_QUICK_MAX 512
+#define DEFAULT_PENALTY   32
+#define HOT_SIZES         2         /* Seglist sizes given exact-fit lists */
+
+#define NUM_BUCKETS ((MAX_TRACKED >> 4) + 1)
+
+static double counts[NUM_BUCKETS];  // Requests per block size / 16.
+
+
+static size_t block_size_of(size_t size)
+{
+    size_t block_size = ALIGN(size);
+    return block_size < MIN_SIZE ? MIN_SIZE : block_size;
+}
+
+static int read_histogram(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        fprintf(stderr, "gen_sizeclass: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    char line[256];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        unsigned long size;
+        double count = 1;
+        lineno++;
+
+        char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '#' || *p == '\n' || *p == '\0') continue;
+
+        int n = sscanf(p, "%lu %lf", &size, &count);
+        if (n < 1 || count < 0)
+        {
+            fprintf(stderr, "gen_sizeclass: %s:%d: expected '<size> [count]'\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+        if (size == 0) continue;  // alloc(0) never reaches a size class
+
+        size_t block_size = block_size_of(size);
+        if (block_size > MAX_TRACKED) block_size = MAX_TRACKED;
+        counts[block_size >> 4] += count;
+    }
+    fclose(f);
+    return 0;
+}
+
+
+/*
+ * Candidates are every block size from MIN_SIZE to quick_max. cost[t][j] is
+ * the padding of the requests up to candidate j using t classes, the largest
+ * of which is candidate j.
+ */
+static void choose_quick_classes(size_t quick_max, double penalty, size_t *classes)
+{
+    int m = (quick_max - MIN_SIZE) / 16 + 1;
+    double cnt[m + 1], wsum[m + 1];  // Prefix sums over candidates.
+    double cost[NUM_QUICK_LISTS + 1][m];
+    int from[NUM_QUICK_LISTS + 1][m];
+
+    cnt[0] = wsum[0] = 0;
+    for (int j = 0; j < m; j++)
+    {
+        size_t size = MIN_SIZE + 16 * j;
+        cnt[j + 1] = cnt[j] + counts[size >> 4];
+        wsum[j + 1] = wsum[j] + counts[size >> 4] * size;
+    }
+
+    // Padding of candidates i+1..j when all are rounded up to candidate j.
+    #define PAD(i, j) ((MIN_SIZE + 16.0 * (j)) * (cnt[(j) + 1] - cnt[(i) + 1]) \
+                       - (wsum[(j) + 1] - wsum[(i) + 1]))
+
+    for (int j = 0; j < m; j++)
+    {
+        cost[1][j] = PAD(-1, j);
+        from[1][j] = -1;
+    }
+    for (int t = 2; t <= NUM_QUICK_LISTS; t++)
+    {
+        for (int j = 0; j < m; j++)
+        {
+            cost[t][j] = INFINITY;
+            from[t][j] = -1;
+            for (int i = t - 2; i < j; i++)
+            {
+                double c = cost[t - 1][i] + PAD(i, j);
+                if (c < cost[t][j])
+                {
+                    cost[t][j] = c;
+                    from[t][j] = i;
+                }
+            }
+        }
+    }
+
+    // Requests above the largest class go to the seglists. On ties prefer the
+    // larger last class, which keeps more of the quick range covered.
+    int best = NUM_QUICK_LISTS - 1;
+    double best_cost = INFINITY;
+    for (int j = NUM_QUICK_LISTS - 1; j < m; j++)
+    {
+        double c = cost[NUM_QUICK_LISTS][j] + penalty * (cnt[m] - cnt[j + 1]);
+        if (c <= best_cost)
+        {
+            best_cost = c;
+            best = j;
+        }
+    }
+    #undef PAD
+
+    for (int t = NUM_QUICK_LISTS, j = best; t >= 1; j = from[t][j], t--)
+        classes[t - 1] = MIN_SIZE + 16 * j;
+}
+
+
+static int cmp_size(const void *a, const void *b)
+{
+    size_t x = *(const size_t *)a, y = *(const size_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Move the unpinned bound closest to target (in log scale) onto target */
+static void pin_bound(size_t *limits, int *pinned, size_t target)
+{
+    int n = NUM_FREE_LISTS - 1, best = -1;
+    double best_dist = INFINITY;
+
+    for (int i = 0; i < n; i++)
+    {
+        if (limits[i] == target)
+        {
+            pinned[i] = 1;
+            return;
+        }
+    }
+    for (int i = 0; i < n; i++)
+    {
+        double dist = fabs(log2((double)limits[i] / target));
+        if (!pinned[i] && dist < best_dist)
+        {
+            best_dist = dist;
+            best = i;
+        }
+    }
+    if (best < 0) return;
+    limits[best] = target;
+    pinned[best] = 1;
+}
+
+static void choose_seglist_limits(size_t quick_top, size_t *limits)
+{
+    int pinned[NUM_FREE_LISTS] = {0};
+    int used[HOT_SIZES];
+
+    for (int i = 0; i < NUM_FREE_LISTS - 1; i++)
+        limits[i] = (size_t)MIN_SIZE << i;
+    limits[NUM_FREE_LISTS - 1] = SIZE_MAX;
+
+    for (int h = 0; h < HOT_SIZES; h++)
+    {
+        used[h] = -1;
+        double best = 0;
+        for (int k = (quick_top >> 4) + 1; k < NUM_BUCKETS - 1; k++)
+        {
+            int taken = 0;
+            for (int g = 0; g < h; g++) taken |= used[g] == k;
+            if (!taken && counts[k] > best)
+            {
+                best = counts[k];
+                used[h] = k;
+            }
+        }
+        if (used[h] < 0) break;
+
+        size_t size = (size_t)used[h] << 4;
+        pin_bound(limits, pinned, size - 16);
+        pin_bound(limits, pinned, size);
+    }
+
+    qsort(limits, NUM_FREE_LISTS - 1, sizeof(*limits), cmp_size);
+}
+
+
+static void emit(const size_t *classes, const size_t *limits, const char *source)
+{
+    int n = (LOOKUP_MAX >> 4) + 1;
+
+    printf("/* Generated by tools/gen_sizeclass from %s. Do not edit. */\n", source);
+    printf("#ifndef SIZECLASS_TABLE_H\n#define SIZECLASS_TABLE_H\n\n");
+    printf("#define QUICK_CLASS_MAX      %zu\n", classes[NUM_QUICK_LISTS - 1]);
+    printf("#define SIZECLASS_LOOKUP_MAX %d\n\n", LOOKUP_MAX);
+
+    printf("#define QUICK_CLASS_SIZES_INIT {");
+    for (int i = 0; i < NUM_QUICK_LISTS; i++)
+        printf("%s%zu", i ? ", " : " ", classes[i]);
+    printf(" }\n\n");
+
+    printf("#define SEGLIST_LIMITS_INIT {");
+    for (int i = 0; i < NUM_FREE_LISTS - 1; i++)
+        printf("%s%zu", i ? ", " : " ", limits[i]);
+    printf(", SIZE_MAX }\n\n");
+
+    // Index by block_size >> 4: smallest quick class that fits.
+    printf("#define QUICK_CLASS_LOOKUP_INIT {");
+    for (int k = 0, q = 0; k <= (int)(classes[NUM_QUICK_LISTS - 1] >> 4); k++)
+    {
+        size_t size = (size_t)k << 4;
+        while (classes[q] < size) q++;
+        printf("%s%s%d", k ? "," : "", k % 16 ? " " : " \\\n    ", q);
+    }
+    printf(" }\n\n");
+
+    // Index by block_size >> 4: first seglist whose limit is >= block_size.
+    printf("#define SEGLIST_LOOKUP_INIT {");
+    for (int k = 0, s = 0; k < n; k++)
+    {
+        size_t size = (size_t)k << 4;
+        while (limits[s] < size) s++;
+        printf("%s%s%d", k ? "," : "", k % 16 ? " " : " \\\n    ", s);
+    }
+    printf(" }\n\n#endif\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    size_t quick_max = DEFAULT_QUICK_MAX;
+    double penalty = DEFAULT_PENALTY;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-q") == 0 && i + 1 < argc)
+            quick_max = strtoul(argv[++i], NULL, 10) & ~(size_t)0xF;
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+            penalty = strtod(argv[++i], NULL);
+        else if (argv[i][0] != '-' && path == NULL)
+            path = argv[i];
+        else
+        {
+            fprintf(stderr, "usage: %s [-q quick_max] [-p penalty] [histogram]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (quick_max < MIN_SIZE + 16 * (NUM_QUICK_LISTS - 1) || quick_max > LOOKUP_MAX)
+    {
+        fprintf(stderr, "gen_sizeclass: quick_max must be between %d and %d\n",
+                MIN_SIZE + 16 * (NUM_QUICK_LISTS - 1), LOOKUP_MAX);
+        return EXIT_FAILURE;
+    }
+
+    size_t classes[NUM_QUICK_LISTS];
+    size_t limits[NUM_FREE_LISTS];
+
+    if (path == NULL)
+    {
+        for (int i = 0; i < NUM_QUICK_LISTS; i++)
+            classes[i] = MIN_SIZE + 16 * i;
+        for (int i = 0; i < NUM_FREE_LISTS - 1; i++)
+            limits[i] = (size_t)MIN_SIZE << i;
+        limits[NUM_FREE_LISTS - 1] = SIZE_MAX;
+        emit(classes, limits, "the default layout");
+        return 0;
+    }
+
+    if (read_histogram(path) == -1) return EXIT_FAILURE;
+    choose_quick_classes(quick_max, penalty, classes);
+    choose_seglist_limits(classes[NUM_QUICK_LISTS - 1], limits);
+    emit(classes, limits, path);
+    return 0;
+}